@@ -0,0 +1,502 @@
+
+#include "autotune.h"
+#include "fft.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// iterations of a sample, a multiple of every number of fused iterations
+#define TUNE_SAMPLE_REPS 8
+#define TUNE_SAMPLES 2
+
+static const char *transport_names[] = {"sendrecv", "nonblocking"};
+static const char *kernel_names[] = {"reference", "separable", "in-place"};
+
+static const int strip_heights[] = {0, 8, 32, 128};
+static const int fused_iterations[] = {1, 2, 4, 8};
+
+#define LENGTH(array) ((int)(sizeof(array) / sizeof(array[0])))
+
+/**
+ * model name of the CPU from /proc/cpuinfo, without tabs.
+ */
+static void read_cpu_model(char *model, int size) {
+  snprintf(model, size, "unknown");
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f == NULL) {
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "model name", 10) == 0) {
+      char *value = strchr(line, ':');
+      if (value != NULL) {
+        value++;
+        while (*value == ' ') {
+          value++;
+        }
+        snprintf(model, size, "%s", value);
+        model[strcspn(model, "\n")] = '\0';
+        for (char *c = model; *c; c++) {
+          if (*c == '\t') {
+            *c = ' ';
+          }
+        }
+      }
+      break;
+    }
+  }
+  fclose(f);
+}
+
+static int find_name(const char *name, const char **names, int count) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * look up the configuration in the wisdom file, the last matching line wins.
+ * Lines tuned for the in-place kernel only have a 14th field "in-place".
+ * @return whether there was an entry
+ */
+static bool read_wisdom(const char *cpu_model, int world, int img_width,
+                        int img_height, pixel_format_t format, bool in_place,
+                        blur_config_t *config, double *default_time,
+                        double *tuned_time) {
+  FILE *f = fopen(WISDOM_FILE, "r");
+  if (f == NULL) {
+    return false;
+  }
+  bool found = false;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    char *fields[14];
+    int field_count = 0;
+    for (char *field = strtok(line, "\t"); field != NULL && field_count < 14;
+         field = strtok(NULL, "\t")) {
+      fields[field_count++] = field;
+    }
+    bool line_in_place = field_count == 14 &&
+                         strcmp(fields[13], kernel_names[KERNEL_IN_PLACE]) == 0;
+    if (field_count < 13 || line_in_place != in_place ||
+        strcmp(fields[0], cpu_model) != 0 ||
+        atoi(fields[1]) != world || atoi(fields[2]) != img_width ||
+        atoi(fields[3]) != img_height ||
+        strcmp(fields[4], pixel_format_name(format)) != 0) {
+      continue;
+    }
+    int transport = find_name(fields[7], transport_names, HALO_TRANSPORT_COUNT);
+    int kernel = find_name(fields[8], kernel_names, KERNEL_VARIANT_COUNT);
+    if (transport < 0 || kernel < 0) {
+      continue;
+    }
+    config->dims[0] = atoi(fields[5]);
+    config->dims[1] = atoi(fields[6]);
+    config->transport = transport;
+    config->kernel = kernel;
+    config->strip_height = atoi(fields[9]);
+    config->fused_iterations = atoi(fields[10]);
+    *default_time = atof(fields[11]);
+    *tuned_time = atof(fields[12]);
+    found = true;
+  }
+  fclose(f);
+  return found;
+}
+
+static void write_wisdom(const char *cpu_model, int world, int img_width,
+                         int img_height, pixel_format_t format, bool in_place,
+                         blur_config_t config, double default_time,
+                         double tuned_time) {
+  FILE *f = fopen(WISDOM_FILE, "a");
+  if (f == NULL) {
+    fprintf(stderr, "autotune: cannot write %s\n", WISDOM_FILE);
+    return;
+  }
+  fprintf(f, "%s\t%d\t%d\t%d\t%s\t%d\t%d\t%s\t%s\t%d\t%d\t%lf\t%lf%s\n",
+          cpu_model, world, img_width, img_height, pixel_format_name(format),
+          config.dims[0], config.dims[1],
+          transport_names[config.transport], kernel_names[config.kernel],
+          config.strip_height, config.fused_iterations, default_time,
+          tuned_time, in_place ? "\tin-place" : "");
+  fclose(f);
+}
+
+static void print_config(const char *prefix, blur_config_t config,
+                         double time) {
+  printf("autotune: %s dims=%dx%d transport=%s kernel=%s strip=%d fused=%d "
+         "%lf\n",
+         prefix, config.dims[0], config.dims[1],
+         transport_names[config.transport], kernel_names[config.kernel],
+         config.strip_height, config.fused_iterations, time);
+}
+
+/**
+ * whether every tile of the grid is at least as large as its border.
+ */
+static bool config_fits(blur_config_t config, int img_width, int img_height) {
+  int border = 2 * config.fused_iterations;
+  return img_width / config.dims[0] >= border &&
+         img_height / config.dims[1] >= border;
+}
+
+/**
+ * time TUNE_SAMPLE_REPS iterations of the blur with the given configuration,
+ * the slowest rank counts.
+ */
+static double time_config(blur_config_t config, int img_width, int img_height,
+                          pixel_format_t format, MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm comm_cart;
+  MPI_Cart_create(comm, 2, config.dims, (int[2]){0, 0}, 0, &comm_cart);
+  int cart_loc[2];
+  MPI_Cart_coords(comm_cart, rank, 2, cart_loc);
+
+  int offset_x, offset_y, local_width, local_height;
+  tile_range(img_width, config.dims[0], cart_loc[0], &offset_x, &local_width);
+  tile_range(img_height, config.dims[1], cart_loc[1], &offset_y,
+             &local_height);
+  int border = 2 * config.fused_iterations;
+  image_t local_img =
+      malloc_image_uninitialized(local_width, local_height, border, format);
+  image_t local_img_out = {0};
+  if (config.kernel != KERNEL_IN_PLACE) {
+    local_img_out =
+        malloc_image_uninitialized(local_width, local_height, border, format);
+  }
+  int border_max_send_count =
+      border_buffer_size(local_width, local_height, border, format);
+  image_buffer_t border_send_buffer =
+      (unsigned char *)malloc(border_max_send_count);
+  image_buffer_t border_recv_buffer =
+      (unsigned char *)malloc(border_max_send_count);
+
+  // warm up caches and connections
+  blur_iterations(&local_img, &local_img_out, config.fused_iterations, config,
+                  cart_loc, border_send_buffer, border_recv_buffer, comm_cart);
+
+  double best_time = -1.0;
+  for (int sample = 0; sample < TUNE_SAMPLES; sample++) {
+    MPI_Barrier(comm_cart);
+    double start_time = MPI_Wtime();
+    blur_iterations(&local_img, &local_img_out, TUNE_SAMPLE_REPS, config,
+                    cart_loc, border_send_buffer, border_recv_buffer,
+                    comm_cart);
+    double total_time = MPI_Wtime() - start_time;
+    MPI_Allreduce(MPI_IN_PLACE, &total_time, 1, MPI_DOUBLE, MPI_MAX,
+                  comm_cart);
+    if (best_time < 0.0 || total_time < best_time) {
+      best_time = total_time;
+    }
+  }
+
+  free(border_send_buffer);
+  free(border_recv_buffer);
+  free_image(local_img);
+  if (config.kernel != KERNEL_IN_PLACE) {
+    free_image(local_img_out);
+  }
+  MPI_Comm_free(&comm_cart);
+  return best_time;
+}
+
+/**
+ * time the blur in the frequency domain once, the slowest rank counts.
+ */
+static double time_fft(blur_config_t config, int img_width, int img_height,
+                       pixel_format_t format, int reps, MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm comm_cart;
+  MPI_Cart_create(comm, 2, config.dims, (int[2]){0, 0}, 0, &comm_cart);
+  int cart_loc[2];
+  MPI_Cart_coords(comm_cart, rank, 2, cart_loc);
+
+  int offset_x, offset_y, local_width, local_height;
+  tile_range(img_width, config.dims[0], cart_loc[0], &offset_x, &local_width);
+  tile_range(img_height, config.dims[1], cart_loc[1], &offset_y,
+             &local_height);
+  image_t local_img =
+      malloc_image_uninitialized(local_width, local_height, 2, format);
+
+  MPI_Barrier(comm_cart);
+  double start_time = MPI_Wtime();
+  fft_blur(local_img, reps, img_width, img_height, config.dims, comm_cart);
+  double total_time = MPI_Wtime() - start_time;
+  MPI_Allreduce(MPI_IN_PLACE, &total_time, 1, MPI_DOUBLE, MPI_MAX, comm_cart);
+
+  free_image(local_img);
+  MPI_Comm_free(&comm_cart);
+  return total_time;
+}
+
+/**
+ * bytes of the images of the direct blur on the rank with the largest tile.
+ */
+static long blur_memory(blur_config_t config, int img_width, int img_height,
+                        pixel_format_t format) {
+  int offset, width, height;
+  tile_range(img_width, config.dims[0], config.dims[0] - 1, &offset, &width);
+  tile_range(img_height, config.dims[1], config.dims[1] - 1, &offset, &height);
+  int border = 2 * config.fused_iterations;
+  int images = config.kernel == KERNEL_IN_PLACE ? 1 : 2;
+  return (long)images * (width + 2 * border) * (height + 2 * border) *
+         PIXEL_SIZE(format);
+}
+
+/**
+ * look up the radius of the FFT in the wisdom file, the last matching line
+ * wins.
+ * @return whether there was an entry
+ */
+static bool read_fft_wisdom(const char *cpu_model, int world, int img_width,
+                            int img_height, pixel_format_t format,
+                            int *radius) {
+  FILE *f = fopen(WISDOM_FILE, "r");
+  if (f == NULL) {
+    return false;
+  }
+  bool found = false;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    char *fields[7];
+    int field_count = 0;
+    for (char *field = strtok(line, "\t"); field != NULL && field_count < 7;
+         field = strtok(NULL, "\t")) {
+      fields[field_count++] = field;
+    }
+    if (field_count != 7 || strcmp(fields[0], "fft") != 0 ||
+        strcmp(fields[1], cpu_model) != 0 || atoi(fields[2]) != world ||
+        atoi(fields[3]) != img_width || atoi(fields[4]) != img_height ||
+        strcmp(fields[5], pixel_format_name(format)) != 0) {
+      continue;
+    }
+    *radius = atoi(fields[6]);
+    found = true;
+  }
+  fclose(f);
+  return found;
+}
+
+static void write_fft_wisdom(const char *cpu_model, int world, int img_width,
+                             int img_height, pixel_format_t format,
+                             int radius) {
+  FILE *f = fopen(WISDOM_FILE, "a");
+  if (f == NULL) {
+    fprintf(stderr, "autotune: cannot write %s\n", WISDOM_FILE);
+    return;
+  }
+  fprintf(f, "fft\t%s\t%d\t%d\t%d\t%s\t%d\n", cpu_model, world, img_width,
+          img_height, pixel_format_name(format), radius);
+  fclose(f);
+}
+
+/**
+ * time the candidate and keep it if it is faster than the best one so far.
+ */
+static void try_config(blur_config_t candidate, int img_width, int img_height,
+                       pixel_format_t format, MPI_Comm comm,
+                       blur_config_t *best, double *best_time) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (!config_fits(candidate, img_width, img_height)) {
+    return;
+  }
+  double time = time_config(candidate, img_width, img_height, format, comm);
+  if (rank == 0) {
+    print_config("trial", candidate, time);
+  }
+  if (time < *best_time) {
+    *best = candidate;
+    *best_time = time;
+  }
+}
+
+blur_config_t autotune_blur_config(int img_width, int img_height,
+                                   pixel_format_t format, bool in_place,
+                                   MPI_Comm comm) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+
+  blur_config_t default_config = default_blur_config(world);
+  blur_config_t best = default_config;
+  char cpu_model[128];
+  double times[2] = {1.0, 1.0}; // default and tuned configuration
+  int found = 0;
+  if (rank == 0) {
+    read_cpu_model(cpu_model, sizeof(cpu_model));
+    found = read_wisdom(cpu_model, world, img_width, img_height, format,
+                        in_place, &best, &times[0], &times[1]);
+  }
+  MPI_Bcast(&found, 1, MPI_INT, 0, comm);
+
+  if (found) {
+    int values[6] = {best.dims[0], best.dims[1], best.transport, best.kernel,
+                     best.strip_height, best.fused_iterations};
+    MPI_Bcast(values, 6, MPI_INT, 0, comm);
+    best.dims[0] = values[0];
+    best.dims[1] = values[1];
+    best.transport = values[2];
+    best.kernel = values[3];
+    best.strip_height = values[4];
+    best.fused_iterations = values[5];
+    if (rank == 0) {
+      print_config("wisdom", best, times[1]);
+    }
+  } else {
+    double best_time =
+        time_config(default_config, img_width, img_height, format, comm);
+    times[0] = best_time;
+    if (rank == 0) {
+      print_config("default", default_config, best_time);
+    }
+    // everything else is tuned around the kernel that was asked for
+    if (in_place) {
+      best.kernel = KERNEL_IN_PLACE;
+      best_time = time_config(best, img_width, img_height, format, comm);
+      if (rank == 0) {
+        print_config("in-place", best, best_time);
+      }
+    }
+
+    // grid
+    for (int d = 1; d <= world; d++) {
+      if (world % d == 0 && d != default_config.dims[0]) {
+        blur_config_t candidate = best;
+        candidate.dims[0] = d;
+        candidate.dims[1] = world / d;
+        try_config(candidate, img_width, img_height, format, comm, &best,
+                   &best_time);
+      }
+    }
+    // kernel and strip height
+    blur_config_t start = best;
+    for (int kernel = 0; kernel < KERNEL_VARIANT_COUNT && !in_place;
+         kernel++) {
+      for (int s = 0; s < LENGTH(strip_heights); s++) {
+        // only the separable kernel works in strips
+        if (kernel != KERNEL_SEPARABLE && strip_heights[s] != 0) {
+          continue;
+        }
+        blur_config_t candidate = start;
+        candidate.kernel = kernel;
+        candidate.strip_height = strip_heights[s];
+        if (candidate.kernel != start.kernel ||
+            candidate.strip_height != start.strip_height) {
+          try_config(candidate, img_width, img_height, format, comm, &best,
+                     &best_time);
+        }
+      }
+    }
+    // border exchange
+    start = best;
+    for (int transport = 0; transport < HALO_TRANSPORT_COUNT; transport++) {
+      if (transport != start.transport) {
+        blur_config_t candidate = start;
+        candidate.transport = transport;
+        try_config(candidate, img_width, img_height, format, comm, &best,
+                   &best_time);
+      }
+    }
+    // fused iterations
+    start = best;
+    for (int f = 0; f < LENGTH(fused_iterations); f++) {
+      if (fused_iterations[f] != start.fused_iterations) {
+        blur_config_t candidate = start;
+        candidate.fused_iterations = fused_iterations[f];
+        try_config(candidate, img_width, img_height, format, comm, &best,
+                   &best_time);
+      }
+    }
+    times[1] = best_time;
+
+    if (rank == 0) {
+      write_wisdom(cpu_model, world, img_width, img_height, format, in_place,
+                   best, times[0], times[1]);
+    }
+  }
+
+  if (rank == 0) {
+    print_config("chosen", best, times[1]);
+    printf("autotune: %.2lfx faster than the default configuration\n",
+           times[0] / times[1]);
+  }
+  return best;
+}
+
+int autotune_fft_radius(blur_config_t config, int img_width, int img_height,
+                        pixel_format_t format, MPI_Comm comm) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+
+  char cpu_model[128];
+  int radius = 0;
+  int found = 0;
+  if (rank == 0) {
+    read_cpu_model(cpu_model, sizeof(cpu_model));
+    found = read_fft_wisdom(cpu_model, world, img_width, img_height, format,
+                            &radius);
+  }
+  MPI_Bcast(&found, 1, MPI_INT, 0, comm);
+
+  if (!found) {
+    double iteration_time =
+        time_config(config, img_width, img_height, format, comm) /
+        TUNE_SAMPLE_REPS;
+    long memory_limit = TUNE_FFT_MAX_MEMORY_RATIO *
+                        blur_memory(config, img_width, img_height, format);
+    // the time of the FFT only changes with the size of the transform
+    for (int reps = 1; reps <= TUNE_FFT_MAX_REPS;) {
+      int width = fft_size(img_width, reps);
+      int height = fft_size(img_height, reps);
+      int last = reps;
+      while (last < TUNE_FFT_MAX_REPS &&
+             fft_size(img_width, last + 1) == width &&
+             fft_size(img_height, last + 1) == height) {
+        last++;
+      }
+      // wider kernels only need larger transforms
+      long memory = fft_memory(img_width, img_height, last, format,
+                               config.dims);
+      if (memory > memory_limit) {
+        if (rank == 0) {
+          printf("autotune: fft %dx%d needs %ld bytes, more than %ld\n",
+                 width, height, memory, memory_limit);
+        }
+        break;
+      }
+      double fft_time =
+          time_fft(config, img_width, img_height, format, last, comm);
+      if (rank == 0) {
+        printf("autotune: trial fft %dx%d iteration=%lf fft=%lf\n", width,
+               height, iteration_time, fft_time);
+      }
+      int faster_from = (int)(fft_time / iteration_time) + 1;
+      if (faster_from <= last) {
+        radius = 2 * (faster_from > reps ? faster_from : reps);
+        break;
+      }
+      reps = last + 1;
+    }
+    if (rank == 0) {
+      write_fft_wisdom(cpu_model, world, img_width, img_height, format,
+                       radius);
+    }
+  }
+
+  MPI_Bcast(&radius, 1, MPI_INT, 0, comm);
+  if (rank == 0) {
+    printf("autotune: fft from radius %d\n", radius);
+  }
+  return radius;
+}
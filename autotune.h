@@ -0,0 +1,47 @@
+#ifndef SRC_AUTOTUNE_H_
+#define SRC_AUTOTUNE_H_
+
+#include "distribute.h"
+#include <mpi.h>
+#include <stdbool.h>
+
+#define WISDOM_FILE "p2.wisdom"
+// largest number of iterations the FFT is compared with
+#define TUNE_FFT_MAX_REPS 256
+// the FFT may use at most this many times the memory of the direct blur
+#define TUNE_FFT_MAX_MEMORY_RATIO 32
+
+/**
+ * fastest configuration for blurring an image of the given size and pixel
+ * format.
+ *
+ * The wisdom file holds one line per CPU model, number of ranks, image size and
+ * pixel format with the chosen configuration. If there is an entry it is used without any
+ * tuning. Otherwise a short sample of the blur is timed on the real tile sizes,
+ * one choice at a time: the grid, the kernel and strip height, the border
+ * exchange and the number of fused iterations. The winner is appended to the
+ * wisdom file. Rank 0 reports how much faster it is than the default
+ * configuration. Has to be called by all ranks of the communicator.
+ *
+ * @param in_place only tune the other choices around the in-place kernel, the
+ * result is kept in wisdom lines of its own
+ */
+blur_config_t autotune_blur_config(int img_width, int img_height,
+                                   pixel_format_t format, bool in_place,
+                                   MPI_Comm comm);
+
+/**
+ * kernel radius 2 * reps from which the blur in the frequency domain is faster
+ * than reps iterations with the given configuration, 0 if it never is within
+ * TUNE_FFT_MAX_REPS iterations. Transforms that need more than
+ * TUNE_FFT_MAX_MEMORY_RATIO times the memory of the direct blur are not
+ * considered.
+ *
+ * Like the configuration it is looked up in the wisdom file, in a line of its
+ * own that starts with "fft", and measured and appended if there is none. Has
+ * to be called by all ranks of the communicator.
+ */
+int autotune_fft_radius(blur_config_t config, int img_width, int img_height,
+                        pixel_format_t format, MPI_Comm comm);
+
+#endif /* SRC_AUTOTUNE_H_ */
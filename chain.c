@@ -0,0 +1,361 @@
+
+#include "chain.h"
+#include "distribute.h"
+#include "kernels.h"
+#include "perfcount.h"
+#include "trace.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// edge length of the blocks the chain is applied to, without the halo
+#define CHAIN_BLOCK_SIZE 64
+
+typedef enum {
+  STAGE_LOOKUP, // consecutive point operations
+  STAGE_BLUR,
+  STAGE_UNSHARP
+} stage_type_t;
+
+typedef struct {
+  stage_type_t type;
+  double amount;          // amount of the unsharp mask
+  unsigned short *lookup; // new value of every sample value
+} stage_t;
+
+static const struct {
+  const char *name;
+  chain_op_type_t type;
+  int param_count;
+} op_names[] = {{"blur", CHAIN_BLUR, 0},
+                {"unsharp", CHAIN_UNSHARP, 1},
+                {"clamp", CHAIN_CLAMP, 2},
+                {"gamma", CHAIN_GAMMA, 1},
+                {"levels", CHAIN_LEVELS, 2}};
+
+#define OP_NAME_COUNT ((int)(sizeof(op_names) / sizeof(op_names[0])))
+
+/**
+ * parse a single operation like "clamp:0.05:0.95".
+ */
+static bool parse_op(const char *spec, chain_op_t *op) {
+  size_t name_length = strcspn(spec, ":");
+  for (int n = 0; n < OP_NAME_COUNT; n++) {
+    if (strlen(op_names[n].name) != name_length ||
+        strncmp(spec, op_names[n].name, name_length) != 0) {
+      continue;
+    }
+    op->type = op_names[n].type;
+    const char *param = spec + name_length;
+    for (int p = 0; p < op_names[n].param_count; p++) {
+      if (*param != ':') {
+        return false;
+      }
+      char *end;
+      op->params[p] = strtod(param + 1, &end);
+      if (end == param + 1) {
+        return false;
+      }
+      param = end;
+    }
+    if (*param != '\0') {
+      return false;
+    }
+    switch (op->type) {
+    case CHAIN_CLAMP:
+      return op->params[0] <= op->params[1];
+    case CHAIN_GAMMA:
+      return op->params[0] > 0.0;
+    case CHAIN_LEVELS:
+      return op->params[0] < op->params[1];
+    default:
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parse_filter_chain(const char *spec, filter_chain_t *chain) {
+  chain->length = 0;
+  while (true) {
+    size_t length = strcspn(spec, ",");
+    char op[64];
+    if (length >= sizeof(op) || chain->length == CHAIN_MAX_OPS) {
+      return false;
+    }
+    memcpy(op, spec, length);
+    op[length] = '\0';
+    if (!parse_op(op, &chain->ops[chain->length++])) {
+      return false;
+    }
+    if (spec[length] == '\0') {
+      return true;
+    }
+    spec += length + 1;
+  }
+}
+
+int filter_chain_halo(filter_chain_t chain) {
+  int halo = 0;
+  for (int i = 0; i < chain.length; i++) {
+    if (chain.ops[i].type == CHAIN_BLUR || chain.ops[i].type == CHAIN_UNSHARP) {
+      halo += 2;
+    }
+  }
+  return halo;
+}
+
+/**
+ * point operation on a sample value between 0 and 1.
+ */
+static double point_op(chain_op_t op, double value) {
+  switch (op.type) {
+  case CHAIN_CLAMP:
+    return MIN(MAX(value, op.params[0]), op.params[1]);
+  case CHAIN_GAMMA:
+    return pow(value, 1.0 / op.params[0]);
+  case CHAIN_LEVELS:
+    return (value - op.params[0]) / (op.params[1] - op.params[0]);
+  default:
+    return value;
+  }
+}
+
+/**
+ * lookup table of count point operations, rounded after each of them.
+ */
+static unsigned short *build_lookup(const chain_op_t *ops, int count,
+                                    int max_value) {
+  unsigned short *lookup =
+      (unsigned short *)malloc(sizeof(unsigned short) * (max_value + 1));
+  for (int v = 0; v <= max_value; v++) {
+    int value = v;
+    for (int i = 0; i < count; i++) {
+      double result = point_op(ops[i], (double)value / max_value);
+      value = (int)(MIN(MAX(result, 0.0), 1.0) * max_value + 0.5);
+    }
+    lookup[v] = value;
+  }
+  return lookup;
+}
+
+/**
+ * stages of the chain, with consecutive point operations merged.
+ * @return number of stages
+ */
+static int compile_stages(filter_chain_t chain, int max_value,
+                          stage_t *stages) {
+  int stage_count = 0;
+  for (int i = 0; i < chain.length;) {
+    stage_t *stage = &stages[stage_count++];
+    stage->lookup = NULL;
+    if (chain.ops[i].type == CHAIN_BLUR) {
+      stage->type = STAGE_BLUR;
+      i++;
+    } else if (chain.ops[i].type == CHAIN_UNSHARP) {
+      stage->type = STAGE_UNSHARP;
+      stage->amount = chain.ops[i].params[0];
+      i++;
+    } else {
+      int first = i;
+      while (i < chain.length && chain.ops[i].type != CHAIN_BLUR &&
+             chain.ops[i].type != CHAIN_UNSHARP) {
+        i++;
+      }
+      stage->type = STAGE_LOOKUP;
+      stage->lookup = build_lookup(&chain.ops[first], i - first, max_value);
+    }
+  }
+  return stage_count;
+}
+
+/**
+ * apply a lookup table to a region. The padding of RGBX stays zero.
+ */
+static void apply_lookup(const unsigned short *lookup, pixel_format_t format,
+                         unsigned char **rows, int y_start, int y_end,
+                         int x_start, int x_end) {
+  int colors = format.channels == 4 ? 3 : format.channels;
+  for (int y = y_start; y < y_end; y++) {
+    for (int x = x_start; x < x_end; x++) {
+      for (int c = 0; c < colors; c++) {
+        int s = x * format.channels + c;
+        if (format.sample_type == SAMPLE_U16) {
+          unsigned short *row = (unsigned short *)rows[y];
+          row[s] = lookup[row[s]];
+        } else {
+          rows[y][s] = lookup[rows[y][s]];
+        }
+      }
+    }
+  }
+}
+
+/**
+ * sharpened = in + amount * (in - blurred), written over blurred.
+ */
+static void apply_unsharp(double amount, int max_value, pixel_format_t format,
+                          unsigned char **in_rows, unsigned char **blur_rows,
+                          int y_start, int y_end, int x_start, int x_end) {
+  for (int y = y_start; y < y_end; y++) {
+    for (int s = x_start * format.channels; s < x_end * format.channels;
+         s++) {
+      int in, blurred;
+      if (format.sample_type == SAMPLE_U16) {
+        in = ((unsigned short *)in_rows[y])[s];
+        blurred = ((unsigned short *)blur_rows[y])[s];
+      } else {
+        in = in_rows[y][s];
+        blurred = blur_rows[y][s];
+      }
+      double value = in + amount * (in - blurred);
+      int result = (int)(MIN(MAX(value, 0.0), (double)max_value) + 0.5);
+      if (format.sample_type == SAMPLE_U16) {
+        ((unsigned short *)blur_rows[y])[s] = result;
+      } else {
+        blur_rows[y][s] = result;
+      }
+    }
+  }
+}
+
+/**
+ * set the pixels of the region outside the valid rectangle to zero.
+ */
+static void clear_outside(pixel_format_t format, unsigned char **rows,
+                          int y_start, int y_end, int x_start, int x_end,
+                          int valid_y_start, int valid_y_end,
+                          int valid_x_start, int valid_x_end) {
+  int pixel_size = PIXEL_SIZE(format);
+  int inner_start = MIN(MAX(valid_x_start, x_start), x_end);
+  int inner_end = MAX(MIN(valid_x_end, x_end), inner_start);
+  for (int y = y_start; y < y_end; y++) {
+    if (y < valid_y_start || y >= valid_y_end) {
+      memset(&rows[y][x_start * pixel_size], 0,
+             (x_end - x_start) * pixel_size);
+    } else {
+      memset(&rows[y][x_start * pixel_size], 0,
+             (inner_start - x_start) * pixel_size);
+      memset(&rows[y][inner_end * pixel_size], 0,
+             (x_end - inner_end) * pixel_size);
+    }
+  }
+}
+
+void apply_filter_chain(filter_chain_t chain, pixel_format_t format,
+                        unsigned char **image_in, int y_start, int y_end,
+                        int x_start, int x_end, int valid_y_start,
+                        int valid_y_end, int valid_x_start, int valid_x_end,
+                        unsigned char **image_out) {
+  int max_value = format.sample_type == SAMPLE_U16 ? 65535 : 255;
+  int pixel_size = PIXEL_SIZE(format);
+  stage_t stages[CHAIN_MAX_OPS];
+  int stage_count = compile_stages(chain, max_value, stages);
+
+  // two scratch blocks including the halo, the stages alternate between them
+  int halo = filter_chain_halo(chain);
+  int scratch_size = CHAIN_BLOCK_SIZE + 2 * halo;
+  unsigned char *scratch_data = (unsigned char *)malloc(
+      2 * (size_t)scratch_size * scratch_size * pixel_size);
+  unsigned char **scratch[2];
+  for (int s = 0; s < 2; s++) {
+    scratch[s] = (unsigned char **)malloc(sizeof(unsigned char *) * scratch_size);
+    for (int r = 0; r < scratch_size; r++) {
+      scratch[s][r] =
+          &scratch_data[((size_t)s * scratch_size + r) * scratch_size *
+                        pixel_size];
+    }
+  }
+
+  for (int block_y = y_start; block_y < y_end; block_y += CHAIN_BLOCK_SIZE) {
+    for (int block_x = x_start; block_x < x_end;
+         block_x += CHAIN_BLOCK_SIZE) {
+      int height = MIN(CHAIN_BLOCK_SIZE, y_end - block_y) + 2 * halo;
+      int width = MIN(CHAIN_BLOCK_SIZE, x_end - block_x) + 2 * halo;
+      // position of the scratch block in the image
+      int origin_y = block_y - halo;
+      int origin_x = block_x - halo;
+      int current = 0;
+      for (int r = 0; r < height; r++) {
+        memcpy(scratch[current][r], &image_in[origin_y + r][origin_x * pixel_size],
+               width * pixel_size);
+      }
+
+      // the part that is still valid shrinks by 2 pixels per stencil
+      int margin = 0;
+      for (int s = 0; s < stage_count; s++) {
+        unsigned char **in = scratch[current];
+        unsigned char **out = scratch[1 - current];
+        if (stages[s].type == STAGE_LOOKUP) {
+          apply_lookup(stages[s].lookup, format, in, margin, height - margin,
+                       margin, width - margin);
+        } else {
+          margin += 2;
+          compute_gaussian_blur_region(KERNEL_SEPARABLE, format, in, margin,
+                                       height - margin, margin,
+                                       width - margin, 0, out);
+          if (stages[s].type == STAGE_UNSHARP) {
+            apply_unsharp(stages[s].amount, max_value, format, in, out,
+                          margin, height - margin, margin, width - margin);
+          }
+          current = 1 - current;
+        }
+        clear_outside(format, scratch[current], margin, height - margin,
+                      margin, width - margin, valid_y_start - origin_y,
+                      valid_y_end - origin_y, valid_x_start - origin_x,
+                      valid_x_end - origin_x);
+      }
+
+      for (int r = halo; r < height - halo; r++) {
+        memcpy(&image_out[origin_y + r][block_x * pixel_size],
+               &scratch[current][r][halo * pixel_size],
+               (width - 2 * halo) * pixel_size);
+      }
+    }
+  }
+
+  for (int s = 0; s < stage_count; s++) {
+    free(stages[s].lookup);
+  }
+  free(scratch[0]);
+  free(scratch[1]);
+  free(scratch_data);
+}
+
+void filter_chain_step(filter_chain_t chain, image_t *local_img,
+                       image_t *local_img_out, int mpi_dims[2],
+                       int cart_loc[2], image_buffer_t border_send_buffer,
+                       image_buffer_t border_recv_buffer, MPI_Comm comm_cart) {
+  int maximum_x = mpi_dims[0] - 1;
+  int maximum_y = mpi_dims[1] - 1;
+  int border = local_img->border;
+  int width = local_img->width;
+  int height = local_img->height;
+
+  // the border is part of the overall image where there is a neighbour
+  int total_width = width + 2 * border;
+  int total_height = height + 2 * border;
+  int valid_x_start = cart_loc[0] > 0 ? 0 : border;
+  int valid_x_end = cart_loc[0] < maximum_x ? total_width : border + width;
+  int valid_y_start = cart_loc[1] > 0 ? 0 : border;
+  int valid_y_end = cart_loc[1] < maximum_y ? total_height : border + height;
+
+  TRACE_BEGIN(TRACE_BLUR);
+  PERF_BEGIN(PERF_PHASE_BLUR);
+  apply_filter_chain(chain, local_img->format, local_img->data, border,
+                     border + height, border, border + width, valid_y_start,
+                     valid_y_end, valid_x_start, valid_x_end,
+                     local_img_out->data);
+  PERF_END(PERF_PHASE_BLUR, (long)width * height);
+  TRACE_END(TRACE_BLUR, -1);
+
+  image_t tmp_img = *local_img;
+  *local_img = *local_img_out;
+  *local_img_out = tmp_img;
+
+  exchange_borders(*local_img, maximum_x, maximum_y, cart_loc[0], cart_loc[1],
+                   border_send_buffer, border_recv_buffer, comm_cart);
+}
@@ -0,0 +1,82 @@
+#ifndef SRC_CHAIN_H_
+#define SRC_CHAIN_H_
+
+#include "image.h"
+#include <mpi.h>
+#include <stdbool.h>
+
+/*
+ * Chains of filters that run in one pass over the image.
+ *
+ * A chain is a list of stencil operations (blur, unsharp mask) and point
+ * operations (clamp, gamma, levels). Every operation gives exactly the result
+ * of running it as a pass of its own over the whole image: samples are rounded
+ * after each operation and pixels outside the image are zero, like the border
+ * of the blur. The executor instead works on small blocks of the image, so the
+ * intermediate results stay in the cache, and merges consecutive point
+ * operations into a single lookup table.
+ *
+ * Parameters of the point operations are relative to the largest sample value,
+ * so the same chain works for 8 and 16 bits.
+ */
+
+#define CHAIN_MAX_OPS 16
+
+typedef enum {
+  CHAIN_BLUR,    // 5x5 gaussian blur
+  CHAIN_UNSHARP, // in + amount * (in - blur(in))
+  CHAIN_CLAMP,   // limit to [low, high]
+  CHAIN_GAMMA,   // raise to the power 1 / gamma
+  CHAIN_LEVELS   // map [black, white] to [0, 1] and clamp
+} chain_op_type_t;
+
+typedef struct {
+  chain_op_type_t type;
+  double params[2]; // amount, low/high, gamma or black/white
+} chain_op_t;
+
+typedef struct {
+  int length;                   // number of operations
+  chain_op_t ops[CHAIN_MAX_OPS]; // operations in the order they are applied
+} filter_chain_t;
+
+/**
+ * parse a chain like "blur,unsharp:1.5,clamp:0.05:0.95,gamma:2.2".
+ * @return whether the chain is valid
+ */
+bool parse_filter_chain(const char *spec, filter_chain_t *chain);
+
+/**
+ * number of pixels around a region that the chain reads, 2 per stencil
+ * operation.
+ */
+int filter_chain_halo(filter_chain_t chain);
+
+/**
+ * apply the chain to the rows y_start..y_end-1 and columns x_start..x_end-1 of
+ * image_in and write the result to image_out.
+ *
+ * The coordinates include the border, @filter_chain_halo@ more pixels are read
+ * on every side. Pixels outside the rectangle valid_x_start..valid_x_end-1,
+ * valid_y_start..valid_y_end-1 lie outside the overall image and count as
+ * zero after every operation.
+ */
+void apply_filter_chain(filter_chain_t chain, pixel_format_t format,
+                        unsigned char **image_in, int y_start, int y_end,
+                        int x_start, int x_end, int valid_y_start,
+                        int valid_y_end, int valid_x_start, int valid_x_end,
+                        unsigned char **image_out);
+
+/**
+ * apply the chain once to the distributed image and exchange the borders.
+ *
+ * The borders of local_img have to be up to date and at least
+ * @filter_chain_halo@ pixels deep. The result ends up in local_img, both
+ * images are swapped.
+ */
+void filter_chain_step(filter_chain_t chain, image_t *local_img,
+                       image_t *local_img_out, int mpi_dims[2],
+                       int cart_loc[2], image_buffer_t border_send_buffer,
+                       image_buffer_t border_recv_buffer, MPI_Comm comm_cart);
+
+#endif /* SRC_CHAIN_H_ */
@@ -1,13 +1,32 @@
 
-
 #ifndef SRC_COMMON_H_
 #define SRC_COMMON_H_
 
-typedef struct pix {
-  unsigned char red;
-  unsigned char green;
-  unsigned char blue;
-} pixel_t;
+typedef enum {
+  SAMPLE_U8 = 1, // one byte per sample
+  SAMPLE_U16 = 2 // two bytes per sample, in host byte order
+} sample_type_t;
+
+/**
+ * layout of a pixel, the samples of all channels are stored after each other.
+ *
+ * Supported are 1 (gray), 3 (RGB) and 4 (RGBX) channels. The fourth channel of
+ * RGBX only pads a pixel to a power of two, it is zero and blurred like the
+ * others.
+ */
+typedef struct {
+  int channels;              // samples per pixel
+  sample_type_t sample_type; // type of a sample
+} pixel_format_t;
+
+// size of a pixel in bytes
+#define PIXEL_SIZE(format) ((format).channels * (int)(format).sample_type)
 
+#define PIXEL_GRAY8 ((pixel_format_t){1, SAMPLE_U8})
+#define PIXEL_RGB8 ((pixel_format_t){3, SAMPLE_U8})
+#define PIXEL_RGBX8 ((pixel_format_t){4, SAMPLE_U8})
+#define PIXEL_GRAY16 ((pixel_format_t){1, SAMPLE_U16})
+#define PIXEL_RGB16 ((pixel_format_t){3, SAMPLE_U16})
+#define PIXEL_RGBX16 ((pixel_format_t){4, SAMPLE_U16})
 
 #endif /* SRC_COMMON_H_ */
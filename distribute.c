@@ -0,0 +1,395 @@
+
+#include "distribute.h"
+#include "perfcount.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+void copy_image_part_to_buffer(image_t image, int x_start, int y_start, int x_end, int y_end, image_buffer_t buffer) {
+  TRACE_BEGIN(TRACE_PACK);
+  PERF_BEGIN(PERF_PHASE_PACK);
+  int pixel_size = PIXEL_SIZE(image.format);
+  int row_size = (x_end - x_start + 1) * pixel_size;
+  int current_buffer_index = 0;
+  for (int y = y_start; y <= y_end; y++) {
+    memcpy(&buffer[current_buffer_index], &image.data[y][x_start * pixel_size],
+           row_size);
+    current_buffer_index += row_size;
+  }
+  PERF_END(PERF_PHASE_PACK, (long)(x_end - x_start + 1) * (y_end - y_start + 1));
+  TRACE_END(TRACE_PACK, -1);
+}
+
+void apply_image_part_from_buffer(image_t image, int x_start, int y_start, int x_end, int y_end, image_buffer_t buffer) {
+  TRACE_BEGIN(TRACE_UNPACK);
+  PERF_BEGIN(PERF_PHASE_PACK);
+  int pixel_size = PIXEL_SIZE(image.format);
+  int row_size = (x_end - x_start + 1) * pixel_size;
+  int current_buffer_index = 0;
+  for (int y = y_start; y <= y_end; y++) {
+    memcpy(&image.data[y][x_start * pixel_size], &buffer[current_buffer_index],
+           row_size);
+    current_buffer_index += row_size;
+  }
+  PERF_END(PERF_PHASE_PACK, (long)(x_end - x_start + 1) * (y_end - y_start + 1));
+  TRACE_END(TRACE_UNPACK, -1);
+}
+
+int get_other_rank(int maximum_x, int maximum_y, int current_x, int current_y, int offset_x, int offset_y) {
+  int ret = MPI_PROC_NULL;
+  int new_x = current_x + offset_x;
+  int new_y = current_y + offset_y;
+  if (new_x <= maximum_x && new_x >= 0 && new_y <= maximum_y && new_y >= 0) {
+    ret = new_x * (maximum_y + 1) + new_y;
+  }
+  return ret;
+}
+
+blur_config_t default_blur_config(int world) {
+  blur_config_t config = {.dims = {0, 0},
+                          .transport = HALO_SENDRECV,
+                          .kernel = KERNEL_REFERENCE,
+                          .strip_height = 0,
+                          .fused_iterations = 1};
+  MPI_Dims_create(world, 2, config.dims);
+  return config;
+}
+
+void tile_range(int size, int parts, int index, int *offset, int *length) {
+  *length = size / parts;
+  *offset = *length * index;
+  if (index + 1 == parts) {
+    *length += size % parts;
+  }
+}
+
+int border_buffer_size(int width, int height, int border,
+                       pixel_format_t format) {
+  // all four sides and corners at once
+  return (2 * (width + height) + 4 * border) * PIXEL_SIZE(format) * border;
+}
+
+void exchange_borders(image_t local_img, int maximum_x, int maximum_y,
+                      int current_x, int current_y,
+                      image_buffer_t border_send_buffer,
+                      image_buffer_t border_recv_buffer, MPI_Comm comm_cart) {
+  int pixel_size = PIXEL_SIZE(local_img.format);
+  int corner_border_send_recv_count = local_img.border * local_img.border * pixel_size;
+  int upper_lower_border_send_recv_count = local_img.width * local_img.border * pixel_size;
+  int left_right_border_send_recv_count = local_img.height * local_img.border * pixel_size;
+  TRACE_BEGIN(TRACE_EXCHANGE);
+
+  /*
+    The border pixel information for all eight neighbours must be exchanged
+  */
+
+  // upper lower border exchange
+  for (int k = 0; k <= 1; k++) {
+    int x_start = local_img.border;
+    int x_end = local_img.border + local_img.width - 1;
+    if ((current_y + k) % 2) {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, 0, -1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, x_start, local_img.border, x_end, 2 * local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, x_start, 0, x_end, local_img.border - 1, border_recv_buffer);
+      }
+    } else {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, 0, +1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, x_start, local_img.height, x_end, local_img.height + local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, x_start, local_img.height + local_img.border, x_end, local_img.height + 2 * local_img.border - 1, border_recv_buffer); 
+      }
+    }
+  }
+
+  // left right border exchange
+  for (int k = 0; k <= 1; k++) {
+    int y_start = local_img.border;
+    int y_end = local_img.border + local_img.height - 1;
+    if ((current_x + k) % 2) {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, 0);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.border, y_start, 2 * local_img.border - 1, y_end, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, 0, y_start, local_img.border - 1, y_end, border_recv_buffer);
+      }
+    } else {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, 0);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.width, y_start, local_img.width + local_img.border - 1, y_end, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, local_img.width + local_img.border, y_start, local_img.width + 2 * local_img.border - 1, y_end, border_recv_buffer);
+      }
+    }
+  }
+
+  // upper left right lower border exchange
+  for (int k = 0; k <= 1; k++) {
+    if ((current_x + k) % 2) {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, -1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.border, local_img.border, 2 * local_img.border - 1, 2 * local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, 0, 0, local_img.border - 1, local_img.border - 1, border_recv_buffer);
+      }
+    } else {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, +1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.width, local_img.height, local_img.width + local_img.border - 1, local_img.height + local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, local_img.width + local_img.border, local_img.height + local_img.border, local_img.width + 2 * local_img.border - 1, local_img.height + 2 * local_img.border - 1, border_recv_buffer);
+      }
+    }
+  }
+
+  // lower left right upper border exchange
+  for (int k = 0; k <= 1; k++) {
+    if ((current_x + k) % 2) {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, +1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.border, local_img.height, 2 * local_img.border - 1, local_img.height + local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, 0, local_img.height + local_img.border, local_img.border - 1, local_img.height + 2 * local_img.border - 1, border_recv_buffer);
+      }
+    } else {
+      int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, -1);
+      if (other_rank != MPI_PROC_NULL) {
+        copy_image_part_to_buffer(local_img, local_img.width, local_img.border, local_img.width + local_img.border - 1, 2 * local_img.border - 1, border_send_buffer);
+        TRACE_BEGIN(TRACE_SENDRECV);
+        MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
+        TRACE_END(TRACE_SENDRECV, other_rank);
+        apply_image_part_from_buffer(local_img, local_img.width + local_img.border, 0, local_img.width + 2 * local_img.border - 1, local_img.border - 1, border_recv_buffer);
+      }
+    }
+  }
+  TRACE_END(TRACE_EXCHANGE, -1);
+}
+
+/**
+ * columns (or rows) to send to and receive from the neighbour in direction d
+ * (-1, 0 or +1) of an image with the given size and border.
+ */
+static void border_range(int d, int size, int border, int *send_start,
+                         int *send_end, int *recv_start, int *recv_end) {
+  if (d < 0) {
+    *send_start = border;
+    *send_end = 2 * border - 1;
+    *recv_start = 0;
+    *recv_end = border - 1;
+  } else if (d > 0) {
+    *send_start = size;
+    *send_end = size + border - 1;
+    *recv_start = size + border;
+    *recv_end = size + 2 * border - 1;
+  } else {
+    *send_start = border;
+    *send_end = border + size - 1;
+    *recv_start = border;
+    *recv_end = border + size - 1;
+  }
+}
+
+void exchange_borders_nonblocking(image_t local_img, int maximum_x,
+                                  int maximum_y, int current_x, int current_y,
+                                  image_buffer_t border_send_buffer,
+                                  image_buffer_t border_recv_buffer,
+                                  MPI_Comm comm_cart) {
+  // the receives come first
+  MPI_Request requests[16];
+  int request_ranks[16];
+  int request_count = 0;
+  int recv_count = 0;
+  int buffer_offsets[8];
+  int other_ranks[8];
+
+  TRACE_BEGIN(TRACE_EXCHANGE);
+
+  // post all receives, then pack and send
+  for (int pass = 0; pass <= 1; pass++) {
+    int part = 0;
+    int buffer_offset = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        if (dx == 0 && dy == 0) {
+          continue;
+        }
+        int x_send_start, x_send_end, x_recv_start, x_recv_end;
+        int y_send_start, y_send_end, y_recv_start, y_recv_end;
+        border_range(dx, local_img.width, local_img.border, &x_send_start,
+                     &x_send_end, &x_recv_start, &x_recv_end);
+        border_range(dy, local_img.height, local_img.border, &y_send_start,
+                     &y_send_end, &y_recv_start, &y_recv_end);
+        int count = (x_send_end - x_send_start + 1) *
+                    (y_send_end - y_send_start + 1) *
+                    PIXEL_SIZE(local_img.format);
+        int other_rank = get_other_rank(maximum_x, maximum_y, current_x,
+                                        current_y, dx, dy);
+        buffer_offsets[part] = buffer_offset;
+        other_ranks[part] = other_rank;
+        if (other_rank != MPI_PROC_NULL) {
+          request_ranks[request_count] = other_rank;
+          if (pass == 0) {
+            MPI_Irecv(border_recv_buffer + buffer_offset, count,
+                      MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart,
+                      &requests[request_count++]);
+            recv_count++;
+          } else {
+            copy_image_part_to_buffer(local_img, x_send_start, y_send_start,
+                                      x_send_end, y_send_end,
+                                      border_send_buffer + buffer_offset);
+            TRACE_BEGIN(TRACE_SEND);
+            MPI_Isend(border_send_buffer + buffer_offset, count,
+                      MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart,
+                      &requests[request_count++]);
+            TRACE_END(TRACE_SEND, other_rank);
+          }
+        }
+        buffer_offset += count;
+        part++;
+      }
+    }
+  }
+  // one receive after the other, so the trace shows whom the rank waits for
+  for (int r = 0; r < recv_count; r++) {
+    int index;
+    TRACE_BEGIN(TRACE_WAIT);
+    MPI_Waitany(recv_count, requests, &index, MPI_STATUS_IGNORE);
+    TRACE_END(TRACE_WAIT, request_ranks[index]);
+  }
+  MPI_Waitall(request_count - recv_count, requests + recv_count,
+              MPI_STATUSES_IGNORE);
+
+  int part = 0;
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      if (dx == 0 && dy == 0) {
+        continue;
+      }
+      if (other_ranks[part] != MPI_PROC_NULL) {
+        int x_send_start, x_send_end, x_recv_start, x_recv_end;
+        int y_send_start, y_send_end, y_recv_start, y_recv_end;
+        border_range(dx, local_img.width, local_img.border, &x_send_start,
+                     &x_send_end, &x_recv_start, &x_recv_end);
+        border_range(dy, local_img.height, local_img.border, &y_send_start,
+                     &y_send_end, &y_recv_start, &y_recv_end);
+        apply_image_part_from_buffer(local_img, x_recv_start, y_recv_start,
+                                     x_recv_end, y_recv_end,
+                                     border_recv_buffer + buffer_offsets[part]);
+      }
+      part++;
+    }
+  }
+  TRACE_END(TRACE_EXCHANGE, -1);
+}
+
+void blur_iterations(image_t *local_img, image_t *local_img_out, int reps,
+                     blur_config_t config, int cart_loc[2],
+                     image_buffer_t border_send_buffer,
+                     image_buffer_t border_recv_buffer, MPI_Comm comm_cart) {
+  int maximum_x = config.dims[0] - 1;
+  int maximum_y = config.dims[1] - 1;
+  int current_x = cart_loc[0];
+  int current_y = cart_loc[1];
+  int border = local_img->border;
+  int width = local_img->width;
+  int height = local_img->height;
+
+  for (int i = 0; i < reps;) {
+    int group = config.fused_iterations;
+    if (group > reps - i) {
+      group = reps - i;
+    }
+    TRACE_BEGIN(TRACE_ITERATION);
+    for (int k = 0; k < group; k++) {
+      // the border on the edge of the overall image has to stay zero
+      int extension = 2 * (group - 1 - k);
+      int x_start = border - (current_x > 0 ? extension : 0);
+      int x_end = border + width + (current_x < maximum_x ? extension : 0);
+      int y_start = border - (current_y > 0 ? extension : 0);
+      int y_end = border + height + (current_y < maximum_y ? extension : 0);
+
+      TRACE_BEGIN(TRACE_BLUR);
+      PERF_BEGIN(PERF_PHASE_BLUR);
+      compute_gaussian_blur_region(config.kernel, local_img->format,
+                                   local_img->data, y_start, y_end, x_start,
+                                   x_end, config.strip_height,
+                                   local_img_out->data);
+      PERF_END_KERNEL(PERF_PHASE_BLUR,
+                      (long)(x_end - x_start) * (y_end - y_start),
+                      config.kernel);
+      TRACE_END(TRACE_BLUR, -1);
+
+      if (config.kernel != KERNEL_IN_PLACE) {
+        image_t tmp_img = *local_img;
+        *local_img = *local_img_out;
+        *local_img_out = tmp_img;
+      }
+    }
+    i += group;
+
+    if (config.transport == HALO_NONBLOCKING) {
+      exchange_borders_nonblocking(*local_img, maximum_x, maximum_y, current_x,
+                                   current_y, border_send_buffer,
+                                   border_recv_buffer, comm_cart);
+    } else {
+      exchange_borders(*local_img, maximum_x, maximum_y, current_x, current_y,
+                       border_send_buffer, border_recv_buffer, comm_cart);
+    }
+    TRACE_END(TRACE_ITERATION, -1);
+  }
+}
+
+void gather_image(image_t local_img, int offset_x, int offset_y,
+                  image_t global_image, MPI_Comm comm) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+
+  // region of the local image: offset_x, offset_y, width, height
+  int region[4] = {offset_x, offset_y, local_img.width, local_img.height};
+  int pixel_size = PIXEL_SIZE(local_img.format);
+  if (rank == 0) {
+    int max_count = global_image.width * global_image.height * pixel_size;
+    image_buffer_t recv_buffer = (unsigned char *)malloc(max_count);
+    for (int other_rank = 1; other_rank < world; other_rank++) {
+      int other_region[4];
+      MPI_Recv(other_region, 4, MPI_INT, other_rank, COMM_TAG, comm,
+               MPI_STATUS_IGNORE);
+      int count = other_region[2] * other_region[3] * pixel_size;
+      MPI_Recv(recv_buffer, count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG,
+               comm, MPI_STATUS_IGNORE);
+      image_from_buffer(recv_buffer, other_region[2], other_region[3],
+                        other_region[0], other_region[1], global_image);
+    }
+    // integrate own image
+    buffer_from_image(local_img, local_img.width, local_img.height, 0, 0,
+                      recv_buffer);
+    image_from_buffer(recv_buffer, local_img.width, local_img.height,
+                      offset_x, offset_y, global_image);
+    free(recv_buffer);
+  } else {
+    int count = local_img.width * local_img.height * pixel_size;
+    image_buffer_t send_buffer = (unsigned char *)malloc(count);
+    buffer_from_image(local_img, local_img.width, local_img.height, 0, 0,
+                      send_buffer);
+    MPI_Send(region, 4, MPI_INT, 0, COMM_TAG, comm);
+    MPI_Send(send_buffer, count, MPI_UNSIGNED_CHAR, 0, COMM_TAG, comm);
+    free(send_buffer);
+  }
+}
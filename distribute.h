@@ -0,0 +1,117 @@
+#ifndef SRC_DISTRIBUTE_H_
+#define SRC_DISTRIBUTE_H_
+
+#include "image.h"
+#include "kernels.h"
+#include <mpi.h>
+
+#define COMM_TAG (0)
+
+typedef enum {
+  HALO_SENDRECV,    // one MPI_Sendrecv per neighbour, in a fixed order
+  HALO_NONBLOCKING, // all eight neighbours at once with MPI_Isend/MPI_Irecv
+  HALO_TRANSPORT_COUNT
+} halo_transport_t;
+
+/**
+ * how the blur is run on the cartesian grid, all choices give the same image.
+ */
+typedef struct {
+  int dims[2];                // number of ranks in x and y direction
+  halo_transport_t transport; // exchange of the borders
+  kernel_variant_t kernel;    // blur kernel
+  int strip_height;           // rows per strip of the kernel, 0 for all
+  int fused_iterations;       // iterations between two border exchanges
+} blur_config_t;
+
+/**
+ * copy the pixels of the rectangle (x_start,y_start)-(x_end,y_end) of an image
+ * into a buffer. The coordinates include the border and both ends are
+ * inclusive.
+ */
+void copy_image_part_to_buffer(image_t image, int x_start, int y_start,
+                               int x_end, int y_end, image_buffer_t buffer);
+
+/**
+ * write the contents of a buffer into the rectangle
+ * (x_start,y_start)-(x_end,y_end) of an image. Counterpart of
+ * @copy_image_part_to_buffer@.
+ */
+void apply_image_part_from_buffer(image_t image, int x_start, int y_start,
+                                  int x_end, int y_end, image_buffer_t buffer);
+
+/**
+ * rank of the neighbour at the given offset in the cartesian grid or
+ * MPI_PROC_NULL if there is no such neighbour.
+ */
+int get_other_rank(int maximum_x, int maximum_y, int current_x, int current_y,
+                   int offset_x, int offset_y);
+
+/**
+ * the configuration used without tuning: the grid of MPI_Dims_create, the
+ * reference kernel and one border exchange per iteration.
+ */
+blur_config_t default_blur_config(int world);
+
+/**
+ * part of a side of the image that the rank at the given cartesian coordinate
+ * holds. The side is split evenly into parts, the last part also takes the
+ * remainder.
+ */
+void tile_range(int size, int parts, int index, int *offset, int *length);
+
+/**
+ * size in bytes of the send and receive buffers needed by @exchange_borders@
+ * and @exchange_borders_nonblocking@ for an image of the given dimensions and
+ * pixel format.
+ */
+int border_buffer_size(int width, int height, int border,
+                       pixel_format_t format);
+
+/**
+ * exchange the border pixels with all eight neighbours.
+ *
+ * The send and receive buffers have to hold at least
+ * @border_buffer_size@ bytes. Borders on the edge of the overall image are not
+ * touched.
+ */
+void exchange_borders(image_t local_img, int maximum_x, int maximum_y,
+                      int current_x, int current_y,
+                      image_buffer_t border_send_buffer,
+                      image_buffer_t border_recv_buffer, MPI_Comm comm_cart);
+
+/**
+ * same as @exchange_borders@, but all borders are sent and received at once.
+ */
+void exchange_borders_nonblocking(image_t local_img, int maximum_x,
+                                  int maximum_y, int current_x, int current_y,
+                                  image_buffer_t border_send_buffer,
+                                  image_buffer_t border_recv_buffer,
+                                  MPI_Comm comm_cart);
+
+/**
+ * blur the distributed image reps times and keep the borders up to date.
+ *
+ * The border of the images has to be 2 * config.fused_iterations pixels deep.
+ * Between two exchanges every iteration also blurs the part of the border that
+ * the following iterations of the group still read, which shrinks by 2 pixels
+ * per iteration. The result ends up in local_img, both images are swapped.
+ * The in-place kernel only uses local_img, local_img_out does not have to be
+ * allocated then.
+ */
+void blur_iterations(image_t *local_img, image_t *local_img_out, int reps,
+                     blur_config_t config, int cart_loc[2],
+                     image_buffer_t border_send_buffer,
+                     image_buffer_t border_recv_buffer, MPI_Comm comm_cart);
+
+/**
+ * collect the local images of all ranks into the global image on rank 0.
+ *
+ * In contrast to the collection at the end of the blur every rank may own a
+ * region of arbitrary size, which is sent along with the pixels. The global
+ * image has to be allocated on rank 0 only.
+ */
+void gather_image(image_t local_img, int offset_x, int offset_y,
+                  image_t global_image, MPI_Comm comm);
+
+#endif /* SRC_DISTRIBUTE_H_ */
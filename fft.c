@@ -0,0 +1,498 @@
+
+#include "fft.h"
+#include "distribute.h"
+#include "perfcount.h"
+#include "trace.h"
+#include <complex.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * smallest power of two that is at least n.
+ */
+static int power_of_two(int n) {
+  int power = 1;
+  while (power < n) {
+    power *= 2;
+  }
+  return power;
+}
+
+/**
+ * exp(-2 pi i k / n) for k < n / 2.
+ */
+static double complex *make_twiddles(int n) {
+  double complex *twiddles =
+      (double complex *)malloc(sizeof(double complex) * (n / 2 + 1));
+  for (int k = 0; k < n / 2; k++) {
+    twiddles[k] = cos(2.0 * M_PI * k / n) - sin(2.0 * M_PI * k / n) * I;
+  }
+  return twiddles;
+}
+
+/**
+ * in-place radix-2 FFT of n values, the inverse is not scaled by 1 / n.
+ */
+static void fft(double complex *data, int n, const double complex *twiddles,
+                bool inverse) {
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      double complex tmp = data[i];
+      data[i] = data[j];
+      data[j] = tmp;
+    }
+  }
+  for (int length = 2; length <= n; length *= 2) {
+    int half = length / 2;
+    int step = n / length;
+    for (int start = 0; start < n; start += length) {
+      for (int k = 0; k < half; k++) {
+        double w_re = creal(twiddles[k * step]);
+        double w_im = inverse ? -cimag(twiddles[k * step]) : cimag(twiddles[k * step]);
+        double complex u = data[start + k];
+        double complex v = data[start + k + half];
+        // written out, a complex product would also handle infinities
+        double complex t = (creal(v) * w_re - cimag(v) * w_im) +
+                           (creal(v) * w_im + cimag(v) * w_re) * I;
+        data[start + k] = u + t;
+        data[start + k + half] = u - t;
+      }
+    }
+  }
+}
+
+/**
+ * part of size split evenly into parts, for the slabs.
+ */
+static void slab_range(int size, int parts, int index, int *start, int *end) {
+  *start = (int)((long)size * index / parts);
+  *end = (int)((long)size * (index + 1) / parts);
+}
+
+static int overlap(int start_a, int end_a, int start_b, int end_b,
+                   int *start, int *end) {
+  *start = start_a > start_b ? start_a : start_b;
+  *end = end_a < end_b ? end_a : end_b;
+  return *end > *start ? *end - *start : 0;
+}
+
+static void all_to_all(double complex *send_buffer, int *send_counts,
+                       double complex *recv_buffer, int *recv_counts,
+                       MPI_Comm comm) {
+  int world;
+  MPI_Comm_size(comm, &world);
+  int *send_displacements = (int *)malloc(sizeof(int) * world);
+  int *recv_displacements = (int *)malloc(sizeof(int) * world);
+  int send_total = 0;
+  int recv_total = 0;
+  for (int r = 0; r < world; r++) {
+    send_displacements[r] = send_total;
+    recv_displacements[r] = recv_total;
+    send_total += send_counts[r];
+    recv_total += recv_counts[r];
+  }
+  TRACE_BEGIN(TRACE_EXCHANGE);
+  MPI_Alltoallv(send_buffer, send_counts, send_displacements,
+                MPI_C_DOUBLE_COMPLEX, recv_buffer, recv_counts,
+                recv_displacements, MPI_C_DOUBLE_COMPLEX, comm);
+  TRACE_END(TRACE_EXCHANGE, -1);
+  free(send_displacements);
+  free(recv_displacements);
+}
+
+static void transform_rows(double complex *rows, long count, int nx,
+                           const double complex *twiddles_x, bool inverse) {
+  for (long row = 0; row < count; row++) {
+    fft(&rows[row * nx], nx, twiddles_x, inverse);
+  }
+}
+
+/**
+ * convolve columns of height values with the kernel. Element y of column x of
+ * pair p is data[p * pair_stride + x * column_stride + y * element_stride];
+ * the column is padded with zeros to ny values in the buffer column.
+ */
+static void blur_columns(double complex *data, int pairs, int column_count,
+                         long pair_stride, long column_stride,
+                         long element_stride, int height, int ny,
+                         const double *kernel_x, const double *kernel_y,
+                         const double complex *twiddles_y,
+                         double complex *column) {
+  for (int p = 0; p < pairs; p++) {
+    for (int x = 0; x < column_count; x++) {
+      double complex *values = &data[p * pair_stride + x * column_stride];
+      for (int y = 0; y < height; y++) {
+        column[y] = values[y * element_stride];
+      }
+      for (int y = height; y < ny; y++) {
+        column[y] = 0.0;
+      }
+      fft(column, ny, twiddles_y, false);
+      for (int y = 0; y < ny; y++) {
+        column[y] *= kernel_x[x] * kernel_y[y];
+      }
+      fft(column, ny, twiddles_y, true);
+      for (int y = 0; y < height; y++) {
+        values[y * element_stride] = column[y];
+      }
+    }
+  }
+}
+
+static double read_sample(image_t image, int y, int x, int channel) {
+  int s = x * image.format.channels + channel;
+  if (image.format.sample_type == SAMPLE_U16) {
+    return ((unsigned short *)image.data[y])[s];
+  }
+  return image.data[y][s];
+}
+
+static void write_sample(image_t image, int y, int x, int channel,
+                         double value) {
+  double max_value = image.format.sample_type == SAMPLE_U16 ? 65535.0 : 255.0;
+  double clamped = value < 0.0 ? 0.0 : value > max_value ? max_value : value;
+  int s = x * image.format.channels + channel;
+  if (image.format.sample_type == SAMPLE_U16) {
+    ((unsigned short *)image.data[y])[s] = (unsigned short)(clamped + 0.5);
+  } else {
+    image.data[y][s] = (unsigned char)(clamped + 0.5);
+  }
+}
+
+int fft_size(int size, int reps) {
+  // the padding keeps the kernel from wrapping around
+  return power_of_two(size + 4 * reps);
+}
+
+long fft_memory(int img_width, int img_height, int reps,
+                pixel_format_t format, int mpi_dims[2]) {
+  int world = mpi_dims[0] * mpi_dims[1];
+  int colors = format.channels == 4 ? 3 : format.channels;
+  long pairs = (colors + 1) / 2;
+  int nx = fft_size(img_width, reps);
+  int ny = fft_size(img_height, reps);
+  // one slab of rows, a column and the transforms of the kernel
+  long rows_size = pairs * ((img_height + world - 1) / world) * nx;
+  long bytes = (rows_size + 2 * ny) * sizeof(double complex) +
+               (nx + ny) * sizeof(double);
+  if (world > 1) {
+    // two slabs that hold the rows, the columns or a tile
+    int offset, tile_width, tile_height;
+    tile_range(img_width, mpi_dims[0], mpi_dims[0] - 1, &offset, &tile_width);
+    tile_range(img_height, mpi_dims[1], mpi_dims[1] - 1, &offset,
+               &tile_height);
+    long columns_size = pairs * ((nx + world - 1) / world) * img_height;
+    long tile_size = pairs * tile_width * tile_height;
+    long slab_size = rows_size > columns_size ? rows_size : columns_size;
+    if (tile_size > slab_size) {
+      slab_size = tile_size;
+    }
+    bytes += (2 * slab_size - rows_size) * sizeof(double complex);
+  }
+  return bytes;
+}
+
+void fft_blur(image_t local_img, int reps, int img_width, int img_height,
+              int mpi_dims[2], MPI_Comm comm_cart) {
+  int rank, world;
+  MPI_Comm_rank(comm_cart, &rank);
+  MPI_Comm_size(comm_cart, &world);
+  int border = local_img.border;
+  int nx = fft_size(img_width, reps);
+  int ny = fft_size(img_height, reps);
+  // channels are transformed in pairs, the padding of RGBX stays zero
+  int colors = local_img.format.channels == 4 ? 3 : local_img.format.channels;
+  int pairs = (colors + 1) / 2;
+
+  // tile of every rank and slabs of rows and columns
+  int *tile_x = (int *)malloc(sizeof(int) * 2 * world);
+  int *tile_y = (int *)malloc(sizeof(int) * 2 * world);
+  int *slab_rows = (int *)malloc(sizeof(int) * 2 * world);
+  int *slab_columns = (int *)malloc(sizeof(int) * 2 * world);
+  for (int r = 0; r < world; r++) {
+    int coords[2];
+    MPI_Cart_coords(comm_cart, r, 2, coords);
+    tile_range(img_width, mpi_dims[0], coords[0], &tile_x[2 * r],
+               &tile_x[2 * r + 1]);
+    tile_range(img_height, mpi_dims[1], coords[1], &tile_y[2 * r],
+               &tile_y[2 * r + 1]);
+    // start and end of the tile
+    tile_x[2 * r + 1] += tile_x[2 * r];
+    tile_y[2 * r + 1] += tile_y[2 * r];
+    slab_range(img_height, world, r, &slab_rows[2 * r],
+               &slab_rows[2 * r + 1]);
+    slab_range(nx, world, r, &slab_columns[2 * r], &slab_columns[2 * r + 1]);
+  }
+  int row_start = slab_rows[2 * rank];
+  int row_count = slab_rows[2 * rank + 1] - row_start;
+  int column_start = slab_columns[2 * rank];
+  int column_count = slab_columns[2 * rank + 1] - column_start;
+  int y0, y1, x0 = tile_x[2 * rank], x1 = tile_x[2 * rank + 1];
+
+  /*
+   * rows[pair][row][x] is padded with zeros up to nx, columns[pair][column][y]
+   * only holds the rows of the image and is padded column by column. On more
+   * than one rank both slabs are allocated large enough for either layout and
+   * for a tile; every transpose packs one of them, exchanges it into the other
+   * and unpacks it back into the first.
+   */
+  long rows_size = (long)pairs * row_count * nx;
+  long columns_size = (long)pairs * column_count * img_height;
+  long tile_size = (long)pairs * (x1 - x0) * (tile_y[2 * rank + 1] -
+                                              tile_y[2 * rank]);
+  long slab_size = rows_size > columns_size ? rows_size : columns_size;
+  if (tile_size > slab_size) {
+    slab_size = tile_size;
+  }
+  double complex *rows = NULL;
+  double complex *columns = NULL;
+  int *send_counts = NULL;
+  int *recv_counts = NULL;
+  if (world == 1) {
+    rows = (double complex *)calloc(rows_size + 1, sizeof(double complex));
+  } else {
+    rows = (double complex *)malloc(sizeof(double complex) * (slab_size + 1));
+    columns =
+        (double complex *)malloc(sizeof(double complex) * (slab_size + 1));
+    send_counts = (int *)malloc(sizeof(int) * world);
+    recv_counts = (int *)malloc(sizeof(int) * world);
+  }
+  double complex *column =
+      (double complex *)malloc(sizeof(double complex) * ny);
+  double complex *twiddles_x = make_twiddles(nx);
+  double complex *twiddles_y = make_twiddles(ny);
+
+  // transform of the kernel, including the scaling of the inverse FFT
+  double *kernel_x = (double *)malloc(sizeof(double) * column_count);
+  double *kernel_y = (double *)malloc(sizeof(double) * ny);
+  for (int x = 0; x < column_count; x++) {
+    kernel_x[x] =
+        pow(cos(M_PI * (column_start + x) / nx), 4.0 * reps) / nx;
+  }
+  for (int y = 0; y < ny; y++) {
+    kernel_y[y] = pow(cos(M_PI * y / ny), 4.0 * reps) / ny;
+  }
+
+  if (world == 1) {
+    // the tile is the whole image and the only slab, nothing is transposed
+    for (int p = 0; p < pairs; p++) {
+      for (int y = 0; y < img_height; y++) {
+        for (int x = 0; x < img_width; x++) {
+          double re = read_sample(local_img, y + border, x + border, 2 * p);
+          double im = 2 * p + 1 < colors ? read_sample(local_img, y + border,
+                                                       x + border, 2 * p + 1)
+                                         : 0.0;
+          rows[((long)p * img_height + y) * nx + x] = re + im * I;
+        }
+      }
+    }
+    TRACE_BEGIN(TRACE_BLUR);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    transform_rows(rows, (long)pairs * img_height, nx, twiddles_x, false);
+    blur_columns(rows, pairs, nx, (long)img_height * nx, 1, nx, img_height,
+                 ny, kernel_x, kernel_y, twiddles_y, column);
+    transform_rows(rows, (long)pairs * img_height, nx, twiddles_x, true);
+    PERF_END(PERF_PHASE_BLUR, (long)img_width * img_height);
+    TRACE_END(TRACE_BLUR, -1);
+  } else {
+    // tiles to slabs of rows
+    long n = 0;
+    for (int r = 0; r < world; r++) {
+      send_counts[r] = 0;
+      if (overlap(tile_y[2 * rank], tile_y[2 * rank + 1], slab_rows[2 * r],
+                  slab_rows[2 * r + 1], &y0, &y1) == 0) {
+        continue;
+      }
+      for (int p = 0; p < pairs; p++) {
+        for (int y = y0; y < y1; y++) {
+          for (int x = x0; x < x1; x++) {
+            int image_y = y - tile_y[2 * rank] + border;
+            int image_x = x - x0 + border;
+            double re = read_sample(local_img, image_y, image_x, 2 * p);
+            double im =
+                2 * p + 1 < colors
+                    ? read_sample(local_img, image_y, image_x, 2 * p + 1)
+                    : 0.0;
+            rows[n++] = re + im * I;
+          }
+        }
+      }
+      send_counts[r] = pairs * (y1 - y0) * (x1 - x0);
+    }
+    for (int r = 0; r < world; r++) {
+      recv_counts[r] =
+          pairs * overlap(tile_y[2 * r], tile_y[2 * r + 1], row_start,
+                          row_start + row_count, &y0, &y1) *
+          (tile_x[2 * r + 1] - tile_x[2 * r]);
+    }
+    all_to_all(rows, send_counts, columns, recv_counts, comm_cart);
+    memset(rows, 0, sizeof(double complex) * rows_size);
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      if (recv_counts[r] == 0) {
+        continue;
+      }
+      overlap(tile_y[2 * r], tile_y[2 * r + 1], row_start,
+              row_start + row_count, &y0, &y1);
+      for (int p = 0; p < pairs; p++) {
+        for (int y = y0; y < y1; y++) {
+          for (int x = tile_x[2 * r]; x < tile_x[2 * r + 1]; x++) {
+            rows[((long)p * row_count + y - row_start) * nx + x] =
+                columns[n++];
+          }
+        }
+      }
+    }
+
+    TRACE_BEGIN(TRACE_BLUR);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    transform_rows(rows, (long)pairs * row_count, nx, twiddles_x, false);
+    PERF_END(PERF_PHASE_BLUR, 0);
+    TRACE_END(TRACE_BLUR, -1);
+
+    // slabs of rows to slabs of columns
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      for (int p = 0; p < pairs; p++) {
+        for (int x = slab_columns[2 * r]; x < slab_columns[2 * r + 1]; x++) {
+          for (int y = 0; y < row_count; y++) {
+            columns[n++] = rows[((long)p * row_count + y) * nx + x];
+          }
+        }
+      }
+      send_counts[r] =
+          pairs * (slab_columns[2 * r + 1] - slab_columns[2 * r]) * row_count;
+      recv_counts[r] =
+          pairs * column_count * (slab_rows[2 * r + 1] - slab_rows[2 * r]);
+    }
+    all_to_all(columns, send_counts, rows, recv_counts, comm_cart);
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      for (int p = 0; p < pairs; p++) {
+        for (int x = 0; x < column_count; x++) {
+          for (int y = slab_rows[2 * r]; y < slab_rows[2 * r + 1]; y++) {
+            columns[((long)p * column_count + x) * img_height + y] = rows[n++];
+          }
+        }
+      }
+    }
+
+    TRACE_BEGIN(TRACE_BLUR);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    blur_columns(columns, pairs, column_count,
+                 (long)column_count * img_height, img_height, 1, img_height,
+                 ny, kernel_x, kernel_y, twiddles_y, column);
+    PERF_END(PERF_PHASE_BLUR, 0);
+    TRACE_END(TRACE_BLUR, -1);
+
+    // back to slabs of rows
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      for (int p = 0; p < pairs; p++) {
+        for (int x = 0; x < column_count; x++) {
+          for (int y = slab_rows[2 * r]; y < slab_rows[2 * r + 1]; y++) {
+            rows[n++] = columns[((long)p * column_count + x) * img_height + y];
+          }
+        }
+      }
+      int count = send_counts[r];
+      send_counts[r] = recv_counts[r];
+      recv_counts[r] = count;
+    }
+    all_to_all(rows, send_counts, columns, recv_counts, comm_cart);
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      for (int p = 0; p < pairs; p++) {
+        for (int x = slab_columns[2 * r]; x < slab_columns[2 * r + 1]; x++) {
+          for (int y = 0; y < row_count; y++) {
+            rows[((long)p * row_count + y) * nx + x] = columns[n++];
+          }
+        }
+      }
+    }
+
+    // the pixels of the slab count once, when they are finished
+    TRACE_BEGIN(TRACE_BLUR);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    transform_rows(rows, (long)pairs * row_count, nx, twiddles_x, true);
+    PERF_END(PERF_PHASE_BLUR, (long)row_count * img_width);
+    TRACE_END(TRACE_BLUR, -1);
+
+    // slabs of rows back to the tiles
+    n = 0;
+    for (int r = 0; r < world; r++) {
+      send_counts[r] = 0;
+      if (overlap(tile_y[2 * r], tile_y[2 * r + 1], row_start,
+                  row_start + row_count, &y0, &y1) == 0) {
+        continue;
+      }
+      for (int p = 0; p < pairs; p++) {
+        for (int y = y0; y < y1; y++) {
+          for (int x = tile_x[2 * r]; x < tile_x[2 * r + 1]; x++) {
+            columns[n++] =
+                rows[((long)p * row_count + y - row_start) * nx + x];
+          }
+        }
+      }
+      send_counts[r] =
+          pairs * (y1 - y0) * (tile_x[2 * r + 1] - tile_x[2 * r]);
+    }
+    for (int r = 0; r < world; r++) {
+      recv_counts[r] =
+          pairs * overlap(tile_y[2 * rank], tile_y[2 * rank + 1],
+                          slab_rows[2 * r], slab_rows[2 * r + 1], &y0, &y1) *
+          (x1 - x0);
+    }
+    all_to_all(columns, send_counts, rows, recv_counts, comm_cart);
+  }
+
+  // round to the nearest level
+  long n = 0;
+  for (int r = 0; r < world; r++) {
+    if (world > 1 && recv_counts[r] == 0) {
+      continue;
+    }
+    overlap(tile_y[2 * rank], tile_y[2 * rank + 1], slab_rows[2 * r],
+            slab_rows[2 * r + 1], &y0, &y1);
+    for (int p = 0; p < pairs; p++) {
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+          int image_y = y - tile_y[2 * rank] + border;
+          int image_x = x - x0 + border;
+          // a single rank reads its slab in place, otherwise the tile arrived
+          // packed
+          double complex value =
+              world == 1 ? rows[((long)p * img_height + y) * nx + x]
+                         : rows[n++];
+          write_sample(local_img, image_y, image_x, 2 * p,
+                       creal(value));
+          if (2 * p + 1 < colors) {
+            write_sample(local_img, image_y, image_x, 2 * p + 1,
+                         cimag(value));
+          }
+        }
+      }
+    }
+  }
+
+  free(tile_x);
+  free(tile_y);
+  free(slab_rows);
+  free(slab_columns);
+  free(rows);
+  free(columns);
+  free(send_counts);
+  free(recv_counts);
+  free(column);
+  free(twiddles_x);
+  free(twiddles_y);
+  free(kernel_x);
+  free(kernel_y);
+}
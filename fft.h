@@ -0,0 +1,68 @@
+#ifndef SRC_FFT_H_
+#define SRC_FFT_H_
+
+#include "image.h"
+#include <mpi.h>
+
+/*
+ * Blur by convolution in the frequency domain.
+ *
+ * reps iterations of the 5x5 gaussian are one convolution with a binomial
+ * kernel of 4 * reps + 1 taps, whose transform is
+ * cos^(4 reps)(pi kx / Nx) * cos^(4 reps)(pi ky / Ny). The image is padded
+ * with zeros to powers of two Nx >= width + 4 reps and Ny >= height + 4 reps
+ * and transformed with a radix-2 FFT, two channels at once as the real and
+ * imaginary part. On more than one rank the tiles are redistributed into
+ * slabs of rows for the row transforms and transposed into slabs of columns
+ * for the column transforms with MPI_Alltoallv, and back. A single rank
+ * transforms the columns of its one slab of rows in place.
+ *
+ * The cost hardly depends on reps, so it pays off for wide kernels, but it
+ * needs 16 bytes per channel pair and padded pixel instead of a few bytes per
+ * pixel. As the result differs from the iterated blur, the FFT is only used
+ * when it is asked for.
+ *
+ * The result is the exact convolution rounded to the nearest level, at most
+ * FFT_TOLERANCE levels off whatever reps is. The iterated blur differs from
+ * it in two ways:
+ *  - it truncates every iteration, by 0 to 255/256 levels of a sample. Flat
+ *    areas more than 2 * reps pixels from the edges lose nothing and both
+ *    results agree there. Elsewhere, in textured areas and in the fading
+ *    margin along the edges, the iterated blur is darker by at most
+ *    reps * 255/256 levels, in practice by about half of that.
+ *  - it resets the outside of the image to zero after every iteration, the
+ *    convolution does so only once. Within FFT_EDGE_BAND(reps) pixels of the
+ *    edge, light that left the image and came back in is kept and the result
+ *    of the FFT is mostly brighter, by up to a quarter of the sample range.
+ */
+
+// levels the result may differ from the exact convolution, by rounding and
+// the error of the transforms
+#define FFT_TOLERANCE 1
+// pixels along the edges that can be reached from outside and back in reps
+// iterations of the 5x5 kernel
+#define FFT_EDGE_BAND(reps) (reps)
+
+/**
+ * length of the transform along a side of the image with the given size.
+ */
+int fft_size(int size, int reps);
+
+/**
+ * bytes that @fft_blur@ allocates on the rank with the largest slabs.
+ */
+long fft_memory(int img_width, int img_height, int reps,
+                pixel_format_t format, int mpi_dims[2]);
+
+/**
+ * blur the distributed image like reps iterations of the gaussian blur.
+ *
+ * Every rank holds the tile of the grid mpi_dims at its cartesian
+ * coordinates, split like for the direct blur. Only the inside of the tiles is
+ * written, the borders have to be exchanged afterwards. Has to be called by
+ * all ranks of comm_cart.
+ */
+void fft_blur(image_t local_img, int reps, int img_width, int img_height,
+              int mpi_dims[2], MPI_Comm comm_cart);
+
+#endif /* SRC_FFT_H_ */
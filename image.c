@@ -3,29 +3,112 @@
 #include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static const struct {
+  const char *name;
+  pixel_format_t format;
+} pixel_formats[] = {
+    {"gray8", {1, SAMPLE_U8}},   {"rgb8", {3, SAMPLE_U8}},
+    {"rgbx8", {4, SAMPLE_U8}},   {"gray16", {1, SAMPLE_U16}},
+    {"rgb16", {3, SAMPLE_U16}},  {"rgbx16", {4, SAMPLE_U16}}};
+
+#define PIXEL_FORMAT_COUNT ((int)(sizeof(pixel_formats) / sizeof(pixel_formats[0])))
+
+const char *pixel_format_name(pixel_format_t format) {
+  for (int f = 0; f < PIXEL_FORMAT_COUNT; f++) {
+    if (pixel_format_equal(format, pixel_formats[f].format)) {
+      return pixel_formats[f].name;
+    }
+  }
+  return "unknown";
+}
+
+bool parse_pixel_format(const char *name, pixel_format_t *format) {
+  for (int f = 0; f < PIXEL_FORMAT_COUNT; f++) {
+    if (strcmp(name, pixel_formats[f].name) == 0) {
+      *format = pixel_formats[f].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pixel_format_valid(pixel_format_t format) {
+  for (int f = 0; f < PIXEL_FORMAT_COUNT; f++) {
+    if (pixel_format_equal(format, pixel_formats[f].format)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pixel_format_equal(pixel_format_t a, pixel_format_t b) {
+  return a.channels == b.channels && a.sample_type == b.sample_type;
+}
+
+static unsigned int read_sample(const unsigned char *pixel,
+                                sample_type_t sample_type, int channel) {
+  if (sample_type == SAMPLE_U16) {
+    return ((const unsigned short *)pixel)[channel];
+  }
+  return pixel[channel];
+}
+
+static void write_sample(unsigned char *pixel, sample_type_t sample_type,
+                         int channel, unsigned int value) {
+  if (sample_type == SAMPLE_U16) {
+    ((unsigned short *)pixel)[channel] = value;
+  } else {
+    pixel[channel] = value;
+  }
+}
+
+void convert_buffer(image_buffer_t source, pixel_format_t source_format,
+                    image_buffer_t target, pixel_format_t target_format,
+                    long pixel_count) {
+  int source_size = PIXEL_SIZE(source_format);
+  int target_size = PIXEL_SIZE(target_format);
+  if (pixel_format_equal(source_format, target_format)) {
+    memcpy(target, source, pixel_count * source_size);
+    return;
+  }
+  for (long i = 0; i < pixel_count; i++) {
+    const unsigned char *source_pixel = &source[i * source_size];
+    unsigned char *target_pixel = &target[i * target_size];
+
+    // red, green, blue and the padding, which is always zero
+    unsigned int color[4] = {0, 0, 0, 0};
+    for (int c = 0; c < 3; c++) {
+      int channel = source_format.channels == 1 ? 0 : c;
+      color[c] = read_sample(source_pixel, source_format.sample_type, channel);
+    }
+    // integer luma of BT.601, exact for gray colors
+    unsigned int gray = (77 * color[0] + 150 * color[1] + 29 * color[2]) >> 8;
+
+    for (int c = 0; c < target_format.channels; c++) {
+      unsigned int value = target_format.channels == 1 ? gray : color[c];
+      if (source_format.sample_type == SAMPLE_U8 &&
+          target_format.sample_type == SAMPLE_U16) {
+        value *= 257;
+      } else if (source_format.sample_type == SAMPLE_U16 &&
+                 target_format.sample_type == SAMPLE_U8) {
+        value >>= 8;
+      }
+      write_sample(target_pixel, target_format.sample_type, c, value);
+    }
+  }
+}
 
 void image_from_buffer(image_buffer_t buffer, int width, int height,
                        int offset_x, int offset_y, image_t target_image) {
   int targetHeight = offset_y + target_image.border;
   int targetWidth  = offset_x + target_image.border;
-  int size = height * width * 3;
-  int offset_width = 0;
-  int offset_height = 0;
-  for (int i = 0; i < size; i += 3) {
-    char red = buffer[i];
-    char green = buffer[i + 1];
-    char blue = buffer[i + 2];
-    pixel_t pixel = {.red = red, .green = green, .blue = blue};
-    target_image
-        .data[targetHeight + offset_height][targetWidth + offset_width] = pixel;
-
-    // jump three values due to RGB are next together
-    if (offset_width + 1 >= width) {
-      offset_width = 0;
-      offset_height++;
-    } else {
-      offset_width++;
-    }
+  int pixel_size = PIXEL_SIZE(target_image.format);
+  // the pixels of a row are next together in both
+  for (int y = 0; y < height; y++) {
+    memcpy(&target_image.data[targetHeight + y][targetWidth * pixel_size],
+           &buffer[(long)y * width * pixel_size], width * pixel_size);
   }
 }
 
@@ -33,41 +116,29 @@ void buffer_from_image(image_t image, int width, int height, int offset_x,
                        int offset_y, image_buffer_t target_buffer) {
   int targetHeight = offset_y + image.border;
   int targetWidth = offset_x + image.border;
-  int size = height * width * 3;
-  int offset_width = 0;
-  int offset_height = 0;
-  for (int i = 0; i < size; i += 3) {
-    pixel_t pixel =
-        image.data[targetHeight + offset_height][targetWidth + offset_width];
-    target_buffer[i] = pixel.red;
-    target_buffer[i + 1] = pixel.green;
-    target_buffer[i + 2] = pixel.blue;
-    // jump three values due to RGB are next together
-    if (offset_width + 1 >= width) {
-      offset_width = 0;
-      offset_height++;
-    } else {
-      offset_width++;
-    }
+  int pixel_size = PIXEL_SIZE(image.format);
+  for (int y = 0; y < height; y++) {
+    memcpy(&target_buffer[(long)y * width * pixel_size],
+           &image.data[targetHeight + y][targetWidth * pixel_size],
+           width * pixel_size);
   }
 }
 
 
-image_t malloc_image_uninitialized(int width, int height, int border) {
+image_t malloc_image_uninitialized(int width, int height, int border,
+                                   pixel_format_t format) {
   image_t image;
   image.border = border;
   image.height = height;
   image.width = width;
+  image.format = format;
   int total_height = height + 2 * border;
   int total_width = width + 2 * border;
 
-  image.data = (pixel_t **)malloc(sizeof(pixel_t *) * total_height);
+  image.data = (unsigned char **)malloc(sizeof(unsigned char *) * total_height);
   for (int y = 0; y < total_height; ++y) {
-    image.data[y] = (pixel_t *)malloc(sizeof(pixel_t) * total_width);
-    for (int x = 0; x < total_width; ++x) {
-      pixel_t pixel = {.red = 0, .green = 0, .blue = 0};
-      image.data[y][x] = pixel;
-    }
+    image.data[y] =
+        (unsigned char *)calloc(total_width, PIXEL_SIZE(format));
   }
   return image;
 }
@@ -80,14 +151,17 @@ void free_image(image_t image) {
   free(image.data);
 }
 
-pixel_t *img(image_t image, int x, int y) {
-  return &image.data[x + image.border][y + image.border];
+unsigned char *img(image_t image, int x, int y) {
+  return &image.data[y + image.border]
+                    [(x + image.border) * PIXEL_SIZE(image.format)];
 }
 
-void print_buffer(image_buffer_t buffer, int width, int height) {
+void print_buffer(image_buffer_t buffer, int width, int height,
+                  pixel_format_t format) {
   for (int y = 0; y < height; y++) {
     for (int x = 0; x < width; x++) {
-      printf("%3d ", *(buffer + (y * width + x) * 3));
+      printf("%3u ", read_sample(&buffer[(y * width + x) * PIXEL_SIZE(format)],
+                                 format.sample_type, 0));
     }
     printf("\n");
   }
@@ -96,7 +170,8 @@ void print_buffer(image_buffer_t buffer, int width, int height) {
 void print_image(image_t image) {
   for (int y = 0; y < image.height + 2 * image.border; y++) {
     for (int x = 0; x < image.width + 2 * image.border; x++) {
-      printf("%3d ", image.data[y][x].blue);
+      printf("%3u ", read_sample(&image.data[y][x * PIXEL_SIZE(image.format)],
+                                 image.format.sample_type, 0));
     }
     printf("\n");
   }
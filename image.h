@@ -2,17 +2,55 @@
 #define SRC_IMAGE_H_
 
 #include "common.h"
+#include <stdbool.h>
 
 typedef struct {
-  int border;     // size of the border
-  int width;      // width of the overall image
-  int height;     // height of the overall iamge
-  pixel_t **data; // image data, including the border
+  int border;            // size of the border
+  int width;             // width of the overall image
+  int height;            // height of the overall iamge
+  pixel_format_t format; // layout of a pixel
+  unsigned char **data;  // rows of the image data, including the border
 } image_t;
 
 
+/**
+ * buffer of pixels without any border. The samples of a pixel are stored
+ * directly after each other, in the format of the image it belongs to.
+ */
 typedef unsigned char *image_buffer_t;
 
+/**
+ * name of a pixel format, e.g. "rgb8" or "gray16".
+ */
+const char *pixel_format_name(pixel_format_t format);
+
+/**
+ * pixel format with the given name.
+ * @return whether there is such a format
+ */
+bool parse_pixel_format(const char *name, pixel_format_t *format);
+
+/**
+ * whether the channel count and sample type are supported.
+ */
+bool pixel_format_valid(pixel_format_t format);
+
+/**
+ * whether two formats are the same.
+ */
+bool pixel_format_equal(pixel_format_t a, pixel_format_t b);
+
+/**
+ * convert pixel_count pixels of a buffer into another pixel format.
+ *
+ * Gray is expanded to all colors, colors are reduced to their luma, the
+ * padding of RGBX is dropped or set to zero. 8-bit samples are scaled to the
+ * full 16-bit range and back. The buffers must not overlap.
+ */
+void convert_buffer(image_buffer_t source, pixel_format_t source_format,
+                    image_buffer_t target, pixel_format_t target_format,
+                    long pixel_count);
+
 /**
  * convert a buffer into an image.
  *
@@ -28,8 +66,8 @@ void image_from_buffer(image_buffer_t buffer, int width, int height,
  * copy the contents of given image into a target buffer.
  *
  * The buffer has to be allocated before calling this function and has to be
- * large enough. The three color-values red, green and blue are stored directly
- * after each other for each pixel. The width, height and offset parameters
+ * large enough. The samples of each pixel are stored directly after each
+ * other, in the format of the image. The width, height and offset parameters
  * specify the dimensions if the (sub-)image that is loaded into the buffer.
  */
 void buffer_from_image(image_t image, int width, int height, int offset_x,
@@ -40,9 +78,11 @@ void buffer_from_image(image_t image, int width, int height, int offset_x,
  * @param width real width of the image
  * @param height real height of the image
  * @param border size of the border to add
+ * @param format layout of a pixel
  * @return image that needs to be freed by @free_image@
  */
-image_t malloc_image_uninitialized(int width, int height, int border);
+image_t malloc_image_uninitialized(int width, int height, int border,
+                                   pixel_format_t format);
 
 /**
  * free an image
@@ -50,17 +90,18 @@ image_t malloc_image_uninitialized(int width, int height, int border);
 void free_image(image_t image);
 
 /**
- * access the image at the coordinate (x,y)
+ * access the first sample of the pixel at the coordinate (x,y)
  */
-pixel_t *img(image_t image, int x, int y);
+unsigned char *img(image_t image, int x, int y);
 
 /**
- * Print the red channel of a buffer.
+ * Print the first channel of a buffer.
  */
-void print_buffer(image_buffer_t buffer, int width, int height);
+void print_buffer(image_buffer_t buffer, int width, int height,
+                  pixel_format_t format);
 
 /**
- * Print image red channel.
+ * Print image first channel.
  */
 void print_image(image_t image);
 
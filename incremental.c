@@ -0,0 +1,299 @@
+
+#include "incremental.h"
+#include "distribute.h"
+#include "kernels.h"
+#include "perfcount.h"
+#include "tiled.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+/**
+ * intersection of two rectangles, the result has a width or height of zero if
+ * they do not overlap.
+ */
+static rect_t intersect_rect(rect_t a, rect_t b) {
+  int x_start = MAX(a.x, b.x);
+  int y_start = MAX(a.y, b.y);
+  int x_end = MIN(a.x + a.width, b.x + b.width);
+  int y_end = MIN(a.y + a.height, b.y + b.height);
+  rect_t result = {.x = x_start,
+                   .y = y_start,
+                   .width = MAX(x_end - x_start, 0),
+                   .height = MAX(y_end - y_start, 0)};
+  return result;
+}
+
+static rect_t expand_rect(rect_t rect, int radius, rect_t bounds) {
+  rect_t result = {.x = rect.x - radius,
+                   .y = rect.y - radius,
+                   .width = rect.width + 2 * radius,
+                   .height = rect.height + 2 * radius};
+  return intersect_rect(result, bounds);
+}
+
+static long rect_area(rect_t rect) {
+  return (long)rect.width * rect.height;
+}
+
+/**
+ * expand the dirty rectangles by the radius and merge the overlapping ones.
+ *
+ * Two expanded rectangles that overlap are replaced by their bounding box if
+ * it is not larger than both together, so pixels are not recomputed twice and
+ * contained or repeated rectangles disappear. The regions are written to
+ * regions, which has to hold dirty_count entries.
+ * @return number of regions
+ */
+static int merge_dirty_regions(rect_t *dirty, int dirty_count, int radius,
+                               rect_t bounds, rect_t *regions) {
+  int count = 0;
+  for (int d = 0; d < dirty_count; d++) {
+    rect_t region = expand_rect(dirty[d], radius, bounds);
+    if (region.width > 0 && region.height > 0) {
+      regions[count++] = region;
+    }
+  }
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (int a = 0; a < count && !merged; a++) {
+      for (int b = a + 1; b < count && !merged; b++) {
+        rect_t overlap = intersect_rect(regions[a], regions[b]);
+        if (overlap.width == 0 || overlap.height == 0) {
+          continue;
+        }
+        int x_start = MIN(regions[a].x, regions[b].x);
+        int y_start = MIN(regions[a].y, regions[b].y);
+        rect_t box = {
+            .x = x_start,
+            .y = y_start,
+            .width = MAX(regions[a].x + regions[a].width,
+                         regions[b].x + regions[b].width) - x_start,
+            .height = MAX(regions[a].y + regions[a].height,
+                          regions[b].y + regions[b].height) - y_start};
+        if (rect_area(box) <= rect_area(regions[a]) + rect_area(regions[b])) {
+          regions[a] = box;
+          regions[b] = regions[--count];
+          merged = true;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * tile of the rank at (i,j) in the grid, with the same partitioning as the
+ * distribution of the full image.
+ */
+static rect_t tile_of_rank(int img_width, int img_height, int mpi_dims[2],
+                           int i, int j) {
+  rect_t tile;
+  tile_range(img_width, mpi_dims[0], i, &tile.x, &tile.width);
+  tile_range(img_height, mpi_dims[1], j, &tile.y, &tile.height);
+  return tile;
+}
+
+/**
+ * parts of the regions that lie in the tile of the given rank. The parts are
+ * written to parts, which has to hold region_count entries.
+ * @return number of parts
+ */
+static int parts_of_rank(int img_width, int img_height, rect_t *regions,
+                         int region_count, int mpi_dims[2], int target_rank,
+                         rect_t *parts) {
+  rect_t tile = tile_of_rank(img_width, img_height, mpi_dims,
+                             target_rank / mpi_dims[1],
+                             target_rank % mpi_dims[1]);
+  int count = 0;
+  for (int r = 0; r < region_count; r++) {
+    rect_t part = intersect_rect(regions[r], tile);
+    if (part.width > 0 && part.height > 0) {
+      parts[count++] = part;
+    }
+  }
+  return count;
+}
+
+/**
+ * blur the window reps times and copy the part out of it.
+ *
+ * The border of the window is zero. Where the window touches the edge of the
+ * image this is the border of the full blur. Along the other sides every
+ * iteration leaves 2 more pixels invalid, so the computed area shrinks by 2
+ * pixels per iteration until only the part is left.
+ */
+static void blur_window(image_buffer_t window_buffer, rect_t window,
+                        rect_t part, int reps, rect_t bounds,
+                        pixel_format_t format, image_buffer_t part_buffer) {
+  int kernel_offset = 2;
+  image_t window_img = malloc_image_uninitialized(window.width, window.height,
+                                                  kernel_offset, format);
+  image_t window_img_out = malloc_image_uninitialized(
+      window.width, window.height, kernel_offset, format);
+  image_from_buffer(window_buffer, window.width, window.height, 0, 0,
+                    window_img);
+  bool left = window.x > bounds.x;
+  bool top = window.y > bounds.y;
+  bool right = window.x + window.width < bounds.x + bounds.width;
+  bool bottom = window.y + window.height < bounds.y + bounds.height;
+  for (int i = 0; i < reps; i++) {
+    int shrink = 2 * (i + 1);
+    int x_start = kernel_offset + (left ? shrink : 0);
+    int x_end = kernel_offset + window.width - (right ? shrink : 0);
+    int y_start = kernel_offset + (top ? shrink : 0);
+    int y_end = kernel_offset + window.height - (bottom ? shrink : 0);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    compute_gaussian_blur_region(KERNEL_REFERENCE, format, window_img.data,
+                                 y_start, y_end, x_start, x_end, 0,
+                                 window_img_out.data);
+    PERF_END_KERNEL(PERF_PHASE_BLUR,
+                    (long)(x_end - x_start) * (y_end - y_start),
+                    KERNEL_REFERENCE);
+    image_t tmp_img = window_img;
+    window_img = window_img_out;
+    window_img_out = tmp_img;
+  }
+  buffer_from_image(window_img, part.width, part.height, part.x - window.x,
+                    part.y - window.y, part_buffer);
+  free_image(window_img);
+  free_image(window_img_out);
+}
+
+/**
+ * copy the input window into the buffer, or read it from the tiled file if one
+ * is given.
+ */
+static void read_window(image_t input_image, const char *tiled_input,
+                        rect_t window, pixel_format_t format,
+                        image_buffer_t buffer, MPI_Comm comm_cart) {
+  if (tiled_input == NULL) {
+    buffer_from_image(input_image, window.width, window.height, window.x,
+                      window.y, buffer);
+    return;
+  }
+  unsigned int err = tiled_read_region(tiled_input, window.x, window.y,
+                                       window.width, window.height, format,
+                                       buffer);
+  if (err) {
+    printf("Tiled Load Error: %u\n", err);
+    MPI_Abort(comm_cart, 1);
+  }
+}
+
+void reblur_dirty_regions(image_t input_image, const char *tiled_input,
+                          image_t output_image,
+                          int img_width, int img_height, rect_t *dirty,
+                          int dirty_count, int reps, pixel_format_t format,
+                          int mpi_dims[2], MPI_Comm comm_cart) {
+  int rank, world;
+  MPI_Comm_rank(comm_cart, &rank);
+  MPI_Comm_size(comm_cart, &world);
+  int radius = 2 * reps;
+  int pixel_size = PIXEL_SIZE(format);
+  rect_t bounds = {.x = 0, .y = 0, .width = img_width, .height = img_height};
+  rect_t *regions = (rect_t *)malloc(sizeof(rect_t) * (dirty_count + 1));
+  rect_t *parts = (rect_t *)malloc(sizeof(rect_t) * (dirty_count + 1));
+  int region_count =
+      merge_dirty_regions(dirty, dirty_count, radius, bounds, regions);
+
+  if (rank == 0) {
+    // the buffers hold the largest window and part of any rank
+    long max_window = 0;
+    long max_part = 0;
+    for (int target_rank = 0; target_rank < world; target_rank++) {
+      int part_count = parts_of_rank(img_width, img_height, regions,
+                                     region_count, mpi_dims, target_rank,
+                                     parts);
+      for (int p = 0; p < part_count; p++) {
+        max_window =
+            MAX(max_window, rect_area(expand_rect(parts[p], radius, bounds)));
+        max_part = MAX(max_part, rect_area(parts[p]));
+      }
+    }
+    image_buffer_t buffer =
+        (unsigned char *)malloc(max_window * pixel_size + 1);
+    image_buffer_t part_buffer =
+        (unsigned char *)malloc(max_part * pixel_size + 1);
+
+    // send the input windows to the ranks that own a part, from a tiled file
+    // every rank reads its own windows
+    for (int target_rank = 1; tiled_input == NULL && target_rank < world;
+         target_rank++) {
+      int part_count = parts_of_rank(img_width, img_height, regions,
+                                     region_count, mpi_dims, target_rank,
+                                     parts);
+      for (int p = 0; p < part_count; p++) {
+        rect_t window = expand_rect(parts[p], radius, bounds);
+        buffer_from_image(input_image, window.width, window.height, window.x,
+                          window.y, buffer);
+        MPI_Send(buffer, window.width * window.height * pixel_size,
+                 MPI_UNSIGNED_CHAR, target_rank, COMM_TAG, comm_cart);
+      }
+    }
+
+    // own parts
+    int part_count = parts_of_rank(img_width, img_height, regions,
+                                   region_count, mpi_dims, 0, parts);
+    for (int p = 0; p < part_count; p++) {
+      rect_t window = expand_rect(parts[p], radius, bounds);
+      read_window(input_image, tiled_input, window, format, buffer,
+                  comm_cart);
+      blur_window(buffer, window, parts[p], reps, bounds, format,
+                  part_buffer);
+      image_from_buffer(part_buffer, parts[p].width, parts[p].height,
+                        parts[p].x, parts[p].y, output_image);
+    }
+
+    // collect the recomputed parts
+    for (int target_rank = 1; target_rank < world; target_rank++) {
+      int part_count = parts_of_rank(img_width, img_height, regions,
+                                     region_count, mpi_dims, target_rank,
+                                     parts);
+      for (int p = 0; p < part_count; p++) {
+        MPI_Recv(part_buffer, parts[p].width * parts[p].height * pixel_size,
+                 MPI_UNSIGNED_CHAR, target_rank, COMM_TAG, comm_cart,
+                 MPI_STATUS_IGNORE);
+        image_from_buffer(part_buffer, parts[p].width, parts[p].height,
+                          parts[p].x, parts[p].y, output_image);
+      }
+    }
+    free(buffer);
+    free(part_buffer);
+  } else {
+    int part_count = parts_of_rank(img_width, img_height, regions,
+                                   region_count, mpi_dims, rank, parts);
+    // receive all windows first, rank 0 only collects after sending
+    image_buffer_t *window_buffers =
+        (image_buffer_t *)malloc(sizeof(image_buffer_t) * (part_count + 1));
+    for (int p = 0; p < part_count; p++) {
+      rect_t window = expand_rect(parts[p], radius, bounds);
+      int count = window.width * window.height * pixel_size;
+      window_buffers[p] = (unsigned char *)malloc(count);
+      if (tiled_input != NULL) {
+        read_window(input_image, tiled_input, window, format,
+                    window_buffers[p], comm_cart);
+      } else {
+        MPI_Recv(window_buffers[p], count, MPI_UNSIGNED_CHAR, 0, COMM_TAG,
+                 comm_cart, MPI_STATUS_IGNORE);
+      }
+    }
+    for (int p = 0; p < part_count; p++) {
+      rect_t window = expand_rect(parts[p], radius, bounds);
+      int count = parts[p].width * parts[p].height * pixel_size;
+      image_buffer_t part_buffer = (unsigned char *)malloc(count);
+      blur_window(window_buffers[p], window, parts[p], reps, bounds, format,
+                  part_buffer);
+      MPI_Send(part_buffer, count, MPI_UNSIGNED_CHAR, 0, COMM_TAG, comm_cart);
+      free(part_buffer);
+      free(window_buffers[p]);
+    }
+    free(window_buffers);
+  }
+  free(regions);
+  free(parts);
+}
@@ -0,0 +1,36 @@
+#ifndef SRC_INCREMENTAL_H_
+#define SRC_INCREMENTAL_H_
+
+#include "image.h"
+#include <mpi.h>
+
+typedef struct {
+  int x;      // left edge of the rectangle
+  int y;      // upper edge of the rectangle
+  int width;  // width of the rectangle
+  int height; // height of the rectangle
+} rect_t;
+
+/**
+ * recompute the parts of a previous blur result that depend on changed input.
+ *
+ * Every dirty rectangle is expanded by the radius of influence of reps
+ * iterations (2 pixels per iteration). Overlapping expanded rectangles are
+ * merged, the regions are split along the tiles of the cartesian grid. Only the ranks whose tiles overlap an expanded rectangle
+ * take part; each of them receives the input window around its part, blurs it
+ * reps times and returns the part. The dirty rectangles and the image size
+ * have to be known on all ranks, the images on rank 0 only.
+ *
+ * @param format pixel format of both images (all ranks)
+ * @param input_image new input image (rank 0), unused with tiled_input
+ * @param tiled_input tiled input file every rank reads its windows from, only
+ * the tiles under the windows are read (all ranks, NULL to use input_image)
+ * @param output_image result of the previous run, updated in place (rank 0)
+ */
+void reblur_dirty_regions(image_t input_image, const char *tiled_input,
+                          image_t output_image,
+                          int img_width, int img_height, rect_t *dirty,
+                          int dirty_count, int reps, pixel_format_t format,
+                          int mpi_dims[2], MPI_Comm comm_cart);
+
+#endif /* SRC_INCREMENTAL_H_ */
@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "kernels.h"
 
@@ -22,31 +23,86 @@ double gaussian_kernel[5][5] =
 int gaussian_kernel_offset = 2;
 
 
-void compute_gaussian_blur(pixel_t **image_in, int height, int width, pixel_t **image_out) {
-  int i, j;
-  int ii, jj;
-  // printf("w=%d h=%d\n", width, height);
+// one set of kernels per supported pixel format, see kernels_template.h
+#define SAMPLE_T unsigned char
+#define CHANNELS 1
+#define SUFFIX u8c1
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#define CHANNELS 3
+#define SUFFIX u8c3
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#define CHANNELS 4
+#define SUFFIX u8c4
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#undef SAMPLE_T
 
-  for(i=gaussian_kernel_offset; i<height+gaussian_kernel_offset; i++) {
-    for(j=gaussian_kernel_offset; j<width+gaussian_kernel_offset; j++) {
+#define SAMPLE_T unsigned short
+#define CHANNELS 1
+#define SUFFIX u16c1
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#define CHANNELS 3
+#define SUFFIX u16c3
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#define CHANNELS 4
+#define SUFFIX u16c4
+#include "kernels_template.h"
+#undef CHANNELS
+#undef SUFFIX
+#undef SAMPLE_T
 
-          double c_red   = 0.0;
-          double c_green = 0.0;
-          double c_blue  = 0.0;
+typedef void (*blur_reference_t)(unsigned char **, int, int, int, int, unsigned char **);
+typedef void (*blur_separable_t)(unsigned char **, int, int, int, int, int, unsigned char **);
+typedef void (*blur_in_place_t)(unsigned char **, int, int, int, int);
+typedef void (*reduce_t)(unsigned char **, int, int, int, int, int, unsigned char **);
 
-          for (ii=-2; ii<=2; ii++) {
-              for(jj=-2; jj<=2; jj++) {
-                c_red   += (double)image_in[i+ii][j+jj].red   * gaussian_kernel[ii+gaussian_kernel_offset][jj+gaussian_kernel_offset];
-                c_green += (double)image_in[i+ii][j+jj].green * gaussian_kernel[ii+gaussian_kernel_offset][jj+gaussian_kernel_offset];
-                c_blue  += (double)image_in[i+ii][j+jj].blue  * gaussian_kernel[ii+gaussian_kernel_offset][jj+gaussian_kernel_offset];
-              }
-          }
+// kernels of all formats, in the order of format_index
+static const blur_reference_t blur_reference_kernels[] = {
+    compute_gaussian_blur_reference_u8c1,  compute_gaussian_blur_reference_u8c3,
+    compute_gaussian_blur_reference_u8c4,  compute_gaussian_blur_reference_u16c1,
+    compute_gaussian_blur_reference_u16c3, compute_gaussian_blur_reference_u16c4};
+static const blur_separable_t blur_separable_kernels[] = {
+    compute_gaussian_blur_separable_u8c1,  compute_gaussian_blur_separable_u8c3,
+    compute_gaussian_blur_separable_u8c4,  compute_gaussian_blur_separable_u16c1,
+    compute_gaussian_blur_separable_u16c3, compute_gaussian_blur_separable_u16c4};
+static const blur_in_place_t blur_in_place_kernels[] = {
+    compute_gaussian_blur_in_place_u8c1,  compute_gaussian_blur_in_place_u8c3,
+    compute_gaussian_blur_in_place_u8c4,  compute_gaussian_blur_in_place_u16c1,
+    compute_gaussian_blur_in_place_u16c3, compute_gaussian_blur_in_place_u16c4};
+static const reduce_t reduce_kernels[] = {
+    compute_gaussian_reduce_u8c1,  compute_gaussian_reduce_u8c3,
+    compute_gaussian_reduce_u8c4,  compute_gaussian_reduce_u16c1,
+    compute_gaussian_reduce_u16c3, compute_gaussian_reduce_u16c4};
 
-          image_out[i][j].red   = (unsigned char)(c_red);
-          image_out[i][j].green = (unsigned char)(c_green);
-          image_out[i][j].blue  = (unsigned char)(c_blue);
-    }
-  }
+static int format_index(pixel_format_t format) {
+  int channel_index = format.channels == 1 ? 0 : format.channels == 3 ? 1 : 2;
+  return (format.sample_type == SAMPLE_U16 ? 3 : 0) + channel_index;
+}
+
+void compute_gaussian_blur(pixel_format_t format, unsigned char **image_in, int height, int width, unsigned char **image_out) {
+  blur_reference_kernels[format_index(format)](image_in, gaussian_kernel_offset, height + gaussian_kernel_offset,
+                                               gaussian_kernel_offset, width + gaussian_kernel_offset, image_out);
+}
 
+void compute_gaussian_blur_region(kernel_variant_t variant, pixel_format_t format, unsigned char **image_in, int y_start, int y_end, int x_start, int x_end, int strip_height, unsigned char **image_out) {
+  if (variant == KERNEL_SEPARABLE) {
+    blur_separable_kernels[format_index(format)](image_in, y_start, y_end, x_start, x_end, strip_height, image_out);
+  } else if (variant == KERNEL_IN_PLACE) {
+    blur_in_place_kernels[format_index(format)](image_in, y_start, y_end, x_start, x_end);
+  } else {
+    blur_reference_kernels[format_index(format)](image_in, y_start, y_end, x_start, x_end, image_out);
+  }
+}
 
+void compute_gaussian_reduce(pixel_format_t format, unsigned char **image_in, int border, int start_y, int start_x, int height, int width, unsigned char **image_out) {
+  reduce_kernels[format_index(format)](image_in, border, start_y, start_x, height, width, image_out);
 }
@@ -4,7 +4,38 @@
 
 #include "common.h"
 
-void compute_gaussian_blur(pixel_t **image_in, int height, int width, pixel_t **image_out);
+typedef enum {
+  KERNEL_REFERENCE, // 5x5 stencil in double precision
+  KERNEL_SEPARABLE, // two integer passes, processed in strips
+  KERNEL_IN_PLACE,  // separable, writes back into the input with a ring of rows
+  KERNEL_VARIANT_COUNT
+} kernel_variant_t;
+
+/**
+ * blur the whole image, which has a border of 2 pixels. All kernels exist for
+ * every supported pixel format, the format selects the one to use.
+ */
+void compute_gaussian_blur(pixel_format_t format, unsigned char **image_in, int height, int width, unsigned char **image_out);
+
+/**
+ * blur the rows y_start..y_end-1 and columns x_start..x_end-1 of image_in.
+ *
+ * The coordinates include the border, two more pixels are read on every side.
+ * All variants give the same result. strip_height is the number of rows the
+ * separable variant processes at once, 0 for all of them. The in-place variant
+ * overwrites the region of image_in and does not use image_out, which may be
+ * NULL.
+ */
+void compute_gaussian_blur_region(kernel_variant_t variant, pixel_format_t format, unsigned char **image_in, int y_start, int y_end, int x_start, int x_end, int strip_height, unsigned char **image_out);
+
+/**
+ * blur and decimate in one pass (REDUCE step of a gaussian pyramid).
+ *
+ * Only every second pixel in both directions is computed, starting at the
+ * interior pixel (start_x, start_y) of image_in. height and width are the
+ * dimensions of image_out, both images have a border of the given size.
+ */
+void compute_gaussian_reduce(pixel_format_t format, unsigned char **image_in, int border, int start_y, int start_x, int height, int width, unsigned char **image_out);
 
 
 
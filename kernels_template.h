@@ -0,0 +1,168 @@
+/*
+ * Blur kernels for one pixel format, included by kernels.c once for every
+ * supported combination of sample type and channel count. Before including,
+ * define
+ *   SAMPLE_T  type of a sample
+ *   CHANNELS  number of channels
+ *   SUFFIX    suffix of the generated function names
+ * With both known at compile time the loops over the channels are unrolled.
+ */
+
+#define KERNEL_NAME_(name, suffix) name##_##suffix
+#define KERNEL_NAME(name, suffix) KERNEL_NAME_(name, suffix)
+
+static void KERNEL_NAME(compute_gaussian_blur_reference, SUFFIX)(unsigned char **image_in, int y_start, int y_end, int x_start, int x_end, unsigned char **image_out) {
+  int i, j;
+  int ii, jj;
+
+  for(i=y_start; i<y_end; i++) {
+    SAMPLE_T *out = (SAMPLE_T *)image_out[i];
+    for(j=x_start; j<x_end; j++) {
+
+          double c[CHANNELS] = {0.0};
+
+          for (ii=-2; ii<=2; ii++) {
+              const SAMPLE_T *in = (const SAMPLE_T *)image_in[i+ii];
+              for(jj=-2; jj<=2; jj++) {
+                for (int k = 0; k < CHANNELS; k++) {
+                  c[k] += (double)in[(j+jj)*CHANNELS + k] * gaussian_kernel[ii+gaussian_kernel_offset][jj+gaussian_kernel_offset];
+                }
+              }
+          }
+
+          for (int k = 0; k < CHANNELS; k++) {
+            out[j*CHANNELS + k] = (SAMPLE_T)(c[k]);
+          }
+    }
+  }
+}
+
+/**
+ * integer version of the blur with one horizontal and one vertical pass.
+ *
+ * The weights of the kernel are k/256 and thus exact in a double, so the sum
+ * of the reference kernel is an exact multiple of 1/256 and truncating it
+ * gives the same result as the integer sum shifted by 8 bits. The sums of
+ * 16-bit samples stay below 2^24. The rows are processed in strips so that
+ * the intermediate rows stay in the cache.
+ */
+static void KERNEL_NAME(compute_gaussian_blur_separable, SUFFIX)(unsigned char **image_in, int y_start, int y_end, int x_start, int x_end, int strip_height, unsigned char **image_out) {
+  static const int weights[5] = {1, 4, 6, 4, 1};
+  int width = x_end - x_start;
+  if (strip_height <= 0 || strip_height > y_end - y_start) {
+    strip_height = y_end - y_start;
+  }
+  // horizontally blurred rows of the strip and the two rows above and below
+  int *rows = (int *)malloc(sizeof(int) * CHANNELS * width * (strip_height + 4));
+
+  for (int strip = y_start; strip < y_end; strip += strip_height) {
+    int strip_end = MIN(strip + strip_height, y_end);
+
+    for (int i = strip - 2; i < strip_end + 2; i++) {
+      int *row = &rows[(i - strip + 2) * width * CHANNELS];
+      const SAMPLE_T *in = (const SAMPLE_T *)image_in[i];
+      for (int j = x_start; j < x_end; j++) {
+        int c[CHANNELS] = {0};
+        for (int jj = -2; jj <= 2; jj++) {
+          for (int k = 0; k < CHANNELS; k++) {
+            c[k] += weights[jj + 2] * in[(j + jj) * CHANNELS + k];
+          }
+        }
+        for (int k = 0; k < CHANNELS; k++) {
+          row[(j - x_start) * CHANNELS + k] = c[k];
+        }
+      }
+    }
+
+    for (int i = strip; i < strip_end; i++) {
+      SAMPLE_T *out = (SAMPLE_T *)image_out[i];
+      for (int j = 0; j < width * CHANNELS; j++) {
+        int c = 0;
+        for (int ii = -2; ii <= 2; ii++) {
+          c += weights[ii + 2] * rows[(i - strip + 2 + ii) * width * CHANNELS + j];
+        }
+        out[x_start * CHANNELS + j] = (SAMPLE_T)(c >> 8);
+      }
+    }
+  }
+
+  free(rows);
+}
+
+/**
+ * separable blur that writes the result back into the image.
+ *
+ * A row is overwritten as soon as its result is known. The rows above it that
+ * are still needed only live in a ring of 5 horizontally blurred rows, which
+ * is filled two rows ahead of the output. The arithmetic is the same as in the
+ * separable kernel, so is the result.
+ */
+static void KERNEL_NAME(compute_gaussian_blur_in_place, SUFFIX)(unsigned char **image, int y_start, int y_end, int x_start, int x_end) {
+  static const int weights[5] = {1, 4, 6, 4, 1};
+  int row_length = (x_end - x_start) * CHANNELS;
+  int *ring = (int *)malloc(sizeof(int) * 5 * row_length);
+
+  for (int i = y_start - 2; i < y_end + 2; i++) {
+    // horizontal pass of row i, which has not been overwritten yet
+    int *row = &ring[((i - y_start + 2) % 5) * row_length];
+    const SAMPLE_T *in = (const SAMPLE_T *)image[i];
+    for (int j = x_start; j < x_end; j++) {
+      int c[CHANNELS] = {0};
+      for (int jj = -2; jj <= 2; jj++) {
+        for (int k = 0; k < CHANNELS; k++) {
+          c[k] += weights[jj + 2] * in[(j + jj) * CHANNELS + k];
+        }
+      }
+      for (int k = 0; k < CHANNELS; k++) {
+        row[(j - x_start) * CHANNELS + k] = c[k];
+      }
+    }
+
+    // vertical pass of row i - 2, the ring holds rows i - 4 to i
+    int out_row = i - 2;
+    if (out_row < y_start) {
+      continue;
+    }
+    SAMPLE_T *out = (SAMPLE_T *)image[out_row];
+    for (int j = 0; j < row_length; j++) {
+      int c = 0;
+      for (int ii = -2; ii <= 2; ii++) {
+        c += weights[ii + 2] * ring[((out_row + ii - y_start + 2) % 5) * row_length + j];
+      }
+      out[x_start * CHANNELS + j] = (SAMPLE_T)(c >> 8);
+    }
+  }
+
+  free(ring);
+}
+
+static void KERNEL_NAME(compute_gaussian_reduce, SUFFIX)(unsigned char **image_in, int border, int start_y, int start_x, int height, int width, unsigned char **image_out) {
+  int i, j;
+  int ii, jj;
+
+  for(i=0; i<height; i++) {
+    int si = border + start_y + 2*i;
+    SAMPLE_T *out = (SAMPLE_T *)image_out[i+border];
+    for(j=0; j<width; j++) {
+          int sj = border + start_x + 2*j;
+
+          double c[CHANNELS] = {0.0};
+
+          for (ii=-2; ii<=2; ii++) {
+              const SAMPLE_T *in = (const SAMPLE_T *)image_in[si+ii];
+              for(jj=-2; jj<=2; jj++) {
+                for (int k = 0; k < CHANNELS; k++) {
+                  c[k] += (double)in[(sj+jj)*CHANNELS + k] * gaussian_kernel[ii+gaussian_kernel_offset][jj+gaussian_kernel_offset];
+                }
+              }
+          }
+
+          for (int k = 0; k < CHANNELS; k++) {
+            out[(j+border)*CHANNELS + k] = (SAMPLE_T)(c[k]);
+          }
+    }
+  }
+}
+
+#undef KERNEL_NAME
+#undef KERNEL_NAME_
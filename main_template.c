@@ -1,59 +1,191 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "autotune.h"
+#include "chain.h"
+#include "distribute.h"
+#include "fft.h"
 #include "image.h"
+#include "incremental.h"
 #include "kernels.h"
 #include "loadbmp.h"
+#include "perfcount.h"
+#include "pyramid.h"
+#include "qoi.h"
+#include "tiled.h"
+#include "trace.h"
 #include <mpi.h>
 
-#define COMM_TAG (0)
-
-void copy_image_part_to_buffer(image_t image, int x_start, int y_start, int x_end, int y_end, image_buffer_t buffer) {
-  int current_buffer_index = 0;
-  for (int y = y_start; y <= y_end; y++) {
-    for (int x = x_start; x <= x_end; x++) {
-      pixel_t *current_pixel = &image.data[y][x];
-      buffer[current_buffer_index + 0] = current_pixel->red;
-      buffer[current_buffer_index + 1] = current_pixel->green;
-      buffer[current_buffer_index + 2] = current_pixel->blue;
-      current_buffer_index += 3;
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// rows per message or read when distributing and collecting the tiles
+#define TRANSFER_STRIP_HEIGHT 64
+
+typedef enum {
+  FORMAT_BMP,  // uncompressed 24-bit BMP
+  FORMAT_QOI,  // lossless QOI, written in parallel
+  FORMAT_TILED // native tiled format, read and written by every rank
+} image_format_t;
+
+static const char *format_names[] = {"bmp", "qoi", "tiled"};
+static const char *format_extensions[] = {"BMP", "QOI", "PGT"};
+
+/**
+ * format with the given name or -1 if there is none.
+ */
+int parse_format(const char *name) {
+  for (int f = 0; f <= FORMAT_TILED; f++) {
+    if (strcmp(name, format_names[f]) == 0) {
+      return f;
     }
   }
+  return -1;
 }
 
-void apply_image_part_from_buffer(image_t image, int x_start, int y_start, int x_end, int y_end, image_buffer_t buffer) {
-  int current_buffer_index = 0;
-  for (int y = y_start; y <= y_end; y++) {
-    for (int x = x_start; x <= x_end; x++) {
-      pixel_t *current_pixel = &image.data[y][x];
-      current_pixel->red = buffer[current_buffer_index + 0];
-      current_pixel->green = buffer[current_buffer_index + 1];
-      current_pixel->blue = buffer[current_buffer_index + 2];
-      current_buffer_index += 3;
-    }
+void print_synopsis(const char *program) {
+  fprintf(stderr,
+          "SYNOPSIS: %s [--pyramid l] [--dirty x,y,w,h]... [--format f] "
+          "[--input-format f] [--pixel-format p] [--autotune] [--in-place] "
+          "[--chain c] [--fft] n\n"
+          "\tn - Number of repetitions, default 5\n"
+          "\t--autotune - use the fastest configuration from " WISDOM_FILE
+          ", find it first if there is none\n"
+          "\t--in-place - blur without a second copy of the tiles, "
+          "--autotune then tunes the rest around it\n"
+          "\t--fft - blur by convolution in the frequency domain, which is "
+          "faster for large n. It does not truncate every iteration, so "
+          "textured areas and the 2 * n pixels along the edges are up to n "
+          "levels brighter, within n pixels of the edges up to a quarter of "
+          "the range. With --autotune only from "
+          "the kernel radius 2 * n on where it was measured to be faster\n"
+          "\t--chain c - after the blur, apply a chain of filters in one "
+          "pass, e.g. blur,unsharp:1.5,clamp:0.05:0.95,gamma:2.2,levels:0:0.8\n"
+          "\t--format f - format of the output, bmp (default), qoi or tiled\n"
+          "\t--input-format f - read MARBLES.BMP (bmp, default) or "
+          "MARBLES.PGT (tiled)\n"
+          "\t--pixel-format p - blur in gray8, rgb8, rgbx8, gray16, rgb16 or "
+          "rgbx16, default is the format of the input. BMP and QOI files are "
+          "converted from and to rgb8\n"
+          "\t--pyramid l - additionally write l levels of a gaussian pyramid "
+          "to MARBLES2_L<level> in the format given by --format\n"
+          "\t--dirty x,y,w,h - only the given rectangle of MARBLES.BMP "
+          "changed since MARBLES2.BMP was written, update it in place. Not "
+          "together with --chain, --fft or --pyramid\n",
+          program);
+}
+
+/**
+ * load an image of the given format, the extension is appended to the name.
+ * The pixel format of the buffer is returned in pixel_format.
+ */
+unsigned int load_image(const char *name, image_format_t format,
+                        image_buffer_t *buffer, unsigned int *width,
+                        unsigned int *height, pixel_format_t *pixel_format) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "%s.%s", name,
+           format_extensions[format]);
+  if (format == FORMAT_TILED) {
+    return tiled_decode_file(filename, buffer, width, height, pixel_format);
+  }
+  *pixel_format = PIXEL_RGB8;
+  if (format == FORMAT_QOI) {
+    return qoi_decode_file(filename, buffer, width, height);
   }
+  return loadbmp_decode_file(filename, buffer, width, height, LOADBMP_RGB);
 }
 
-int get_other_rank(int maximum_x, int maximum_y, int current_x, int current_y, int offset_x, int offset_y) {
-  int ret = MPI_PROC_NULL;
-  int new_x = current_x + offset_x;
-  int new_y = current_y + offset_y;
-  if (new_x <= maximum_x && new_x >= 0 && new_y <= maximum_y && new_y >= 0) {
-    ret = new_x * (maximum_y + 1) + new_y;
+/**
+ * convert a buffer in place to another pixel format, the buffer is
+ * reallocated if necessary.
+ */
+void convert_loaded_buffer(image_buffer_t *buffer, pixel_format_t format,
+                           pixel_format_t target_format, long pixel_count) {
+  if (pixel_format_equal(format, target_format)) {
+    return;
+  }
+  image_buffer_t converted_buffer =
+      (unsigned char *)malloc(pixel_count * PIXEL_SIZE(target_format));
+  convert_buffer(*buffer, format, converted_buffer, target_format,
+                 pixel_count);
+  free(*buffer);
+  *buffer = converted_buffer;
+}
+
+/**
+ * save an image in the given format, the extension is appended to the name.
+ * Only the tiled format keeps the pixel format of the image.
+ */
+void save_image(const char *name, image_format_t format, image_t image) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "%s.%s", name,
+           format_extensions[format]);
+  image_buffer_t buffer = (unsigned char *)malloc(
+      image.width * image.height * PIXEL_SIZE(image.format));
+  buffer_from_image(image, image.width, image.height, 0, 0, buffer);
+  if (format != FORMAT_TILED) {
+    convert_loaded_buffer(&buffer, image.format, PIXEL_RGB8,
+                          (long)image.width * image.height);
+  }
+  if (format == FORMAT_QOI) {
+    int err = qoi_encode_file(filename, buffer, image.width, image.height);
+    if (err) {
+      printf("QOI Save Error: %u\n", err);
+    }
+  } else if (format == FORMAT_TILED) {
+    int err = tiled_encode_file(filename, buffer, image.width, image.height,
+                                image.format, TILED_DEFAULT_TILE_SIZE);
+    if (err) {
+      printf("Tiled Save Error: %u\n", err);
+    }
+  } else {
+    int err = loadbmp_encode_file(filename, buffer, image.width, image.height,
+                                  LOADBMP_RGB);
+    if (err) {
+      printf("LoadBMP Save Error: %u\n", err);
+    }
   }
-  return ret;
+  free(buffer);
 }
 
 int main(int argc, char *argv[]) {
   int reps = 5;
   // global vars for rank0
-  image_t global_image;
+  image_t global_image = {0};
+  image_t cached_image;
   image_buffer_t global_buffer = NULL;
   int kernel_offset = 2;
+  // levels of the gaussian pyramid, all of them end up on rank0
+  int pyramid_levels = 0;
+  int pyramid_built = 0;
+  image_t *pyramid = NULL;
+  // changed regions of the input for an incremental update of the output
+  rect_t *dirty = NULL;
+  int dirty_count = 0;
+  image_format_t format = FORMAT_BMP;
+  image_format_t input_format = FORMAT_BMP;
+  // size of the image, known by all ranks after the broadcast
+  int img_dims[2];
+  // layout of the pixels, same for all ranks after the broadcast
+  pixel_format_t pixel_format = PIXEL_RGB8;
+  bool pixel_format_given = false;
+  bool tune = false;
+  bool in_place = false;
+  // blur in the frequency domain, with --autotune only where it is faster
+  bool fft = false;
+  // filters applied after the blur, empty without --chain
+  filter_chain_t chain = {0};
+  // whether the ranks already wrote the output themselves
+  bool output_saved = false;
+  // rows of a tile of MARBLES.PGT, the strips read from it end on them
+  int input_tile_height = TRANSFER_STRIP_HEIGHT;
 
   // wall clock time
   double spent_time = -1.0;
+  double pyramid_time = -1.0;
+  double chain_time = -1.0;
 
   // initialize MPI
   int success = MPI_Init(&argc, &argv);
@@ -65,98 +197,297 @@ int main(int argc, char *argv[]) {
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &world);
 
-  if (argc == 2) {
-    if (strcmp(argv[1], "--help") != 0 && strcmp(argv[1], "-h") != 0) {
-      reps = strtol(argv[1], NULL, 10);
-    } else {
-      if (rank == 0) {
-        fprintf(stderr,
-                "SYNOPSIS: %s n\n\tn - Number of repetitions, default 5\n",
-                argv[0]);
+  bool usage = false;
+  bool reps_given = false;
+  dirty = (rect_t *)malloc(sizeof(rect_t) * argc);
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--help") == 0 || strcmp(argv[arg], "-h") == 0) {
+      usage = true;
+    } else if (strcmp(argv[arg], "--pyramid") == 0 && arg + 1 < argc) {
+      pyramid_levels = strtol(argv[++arg], NULL, 10);
+    } else if (strcmp(argv[arg], "--autotune") == 0) {
+      tune = true;
+    } else if (strcmp(argv[arg], "--in-place") == 0) {
+      in_place = true;
+    } else if (strcmp(argv[arg], "--fft") == 0) {
+      fft = true;
+    } else if (strcmp(argv[arg], "--chain") == 0 && arg + 1 < argc) {
+      if (!parse_filter_chain(argv[++arg], &chain)) {
+        usage = true;
       }
-      MPI_Finalize();
-      return 1;
+    } else if (strcmp(argv[arg], "--format") == 0 && arg + 1 < argc) {
+      int parsed_format = parse_format(argv[++arg]);
+      if (parsed_format < 0) {
+        usage = true;
+      } else {
+        format = parsed_format;
+      }
+    } else if (strcmp(argv[arg], "--input-format") == 0 && arg + 1 < argc) {
+      int parsed_format = parse_format(argv[++arg]);
+      if (parsed_format != FORMAT_BMP && parsed_format != FORMAT_TILED) {
+        usage = true;
+      } else {
+        input_format = parsed_format;
+      }
+    } else if (strcmp(argv[arg], "--pixel-format") == 0 && arg + 1 < argc) {
+      if (!parse_pixel_format(argv[++arg], &pixel_format)) {
+        usage = true;
+      }
+      pixel_format_given = true;
+    } else if (strcmp(argv[arg], "--dirty") == 0 && arg + 1 < argc) {
+      rect_t *rect = &dirty[dirty_count++];
+      if (sscanf(argv[++arg], "%d,%d,%d,%d", &rect->x, &rect->y, &rect->width,
+                 &rect->height) != 4) {
+        usage = true;
+      }
+    } else if (!reps_given) {
+      reps = strtol(argv[arg], NULL, 10);
+      reps_given = true;
+    } else {
+      usage = true;
     }
-  } else if (argc > 2) {
+  }
+  // the incremental update only knows the iterated blur and no pyramid
+  if (dirty_count > 0 && (chain.length > 0 || fft || pyramid_levels > 0)) {
+    usage = true;
+  }
+  if (usage) {
     if (rank == 0) {
-      fprintf(stderr, "SYNOPSIS: %s n\n\tn - Number of repetitions, default 5\n",
-              argv[0]);
+      print_synopsis(argv[0]);
     }
     MPI_Finalize();
     return 1;
   }
+  PERF_INIT();
+  TRACE_INIT();
 
   // load image
   if (rank == 0) {
     unsigned int width;
     unsigned int height;
 
+    TRACE_BEGIN(TRACE_IO);
+
+    PERF_BEGIN(PERF_PHASE_IO);
+
     // load image
-    int err = loadbmp_decode_file("MARBLES.BMP", &global_buffer, &width,
-                                  &height, LOADBMP_RGB);
+    int err;
+    if (input_format == FORMAT_TILED) {
+      // every rank reads its own tile or dirty windows later on, only the
+      // size is needed
+      tiled_header_t header;
+      err = tiled_read_header("MARBLES.PGT", &header);
+      if (!err) {
+        width = header.width;
+        height = header.height;
+        if (!pixel_format_given) {
+          pixel_format = header.format;
+        }
+        input_tile_height = header.tile_height;
+        tiled_free_header(header);
+      }
+    } else {
+      pixel_format_t buffer_format;
+      err = load_image("MARBLES", input_format, &global_buffer, &width,
+                       &height, &buffer_format);
+      if (!err) {
+        if (!pixel_format_given) {
+          pixel_format = buffer_format;
+        }
+        convert_loaded_buffer(&global_buffer, buffer_format, pixel_format,
+                              (long)width * height);
+      }
+    }
     if (err) {
-      printf("LoadBMP Load Error: %u", err);
+      printf("Load Error: %u", err);
       return 1;
     }
     if (width < world || height < world) {
       fprintf(stderr, "Image is too small\n");
       return 1;
     }
+    img_dims[0] = width;
+    img_dims[1] = height;
 
     //printf("width*height=%d*%d=%d\n", width, height, width * height);
 
-    // convert image
-    global_image = malloc_image_uninitialized(width, height, kernel_offset);
-    image_from_buffer(global_buffer, width, height, 0, 0, global_image);
-  }
+    // convert image, the full image is only needed to collect a BMP
+    if (global_buffer != NULL || (format == FORMAT_BMP && dirty_count == 0)) {
+      global_image = malloc_image_uninitialized(width, height, kernel_offset,
+                                                pixel_format);
+    }
+    if (global_buffer != NULL) {
+      image_from_buffer(global_buffer, width, height, 0, 0, global_image);
+    }
 
-  // transform image
-  {
+    // load the result of the previous run
+    if (dirty_count > 0) {
+      image_buffer_t cached_buffer = NULL;
+      unsigned int cached_width;
+      unsigned int cached_height;
+      pixel_format_t cached_format;
+      err = load_image("MARBLES2", format, &cached_buffer, &cached_width,
+                       &cached_height, &cached_format);
+      if (err) {
+        printf("Load Error: %u", err);
+        return 1;
+      }
+      if (cached_width != width || cached_height != height) {
+        fprintf(stderr, "MARBLES2 does not match the size of MARBLES\n");
+        return 1;
+      }
+      convert_loaded_buffer(&cached_buffer, cached_format, pixel_format,
+                            (long)width * height);
+      cached_image = malloc_image_uninitialized(width, height, kernel_offset,
+                                                pixel_format);
+      image_from_buffer(cached_buffer, width, height, 0, 0, cached_image);
+      free(cached_buffer);
+    }
+    PERF_END(PERF_PHASE_IO, (long)width * height);
+    TRACE_END(TRACE_IO, -1);
+  }
 
-    MPI_Status status;
-    // setup cart-communicator
+  // broadcast pixel format and the tile height of the tiled input
+  int format_values[3] = {pixel_format.channels, pixel_format.sample_type,
+                          input_tile_height};
+  MPI_Bcast(format_values, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  pixel_format.channels = format_values[0];
+  pixel_format.sample_type = format_values[1];
+  input_tile_height = format_values[2];
+  PERF_CHANNELS(pixel_format.channels);
+
+  if (dirty_count > 0) {
+    // recompute only the regions that depend on the dirty rectangles
     int mpi_dims[2] = {0,0};
     MPI_Comm comm_cart;
-    int cart_rank;
     MPI_Dims_create(world, 2, mpi_dims);
     MPI_Cart_create(MPI_COMM_WORLD, 2, mpi_dims, (int[2]){0, 0}, 0, &comm_cart);
-    MPI_Comm_rank(MPI_COMM_WORLD, &cart_rank);
-    int cart_loc[2];
-    MPI_Cart_coords(comm_cart, rank, 2, cart_loc);
 
-    // broadcast image size
-    int img_dims[2];
+    MPI_Bcast(img_dims, 2, MPI_INT, 0, comm_cart);
+
+    double start_time = MPI_Wtime();
+    reblur_dirty_regions(global_image,
+                         input_format == FORMAT_TILED ? "MARBLES.PGT" : NULL,
+                         cached_image, img_dims[0], img_dims[1],
+                         dirty, dirty_count, reps, pixel_format, mpi_dims,
+                         comm_cart);
+    double total_time = MPI_Wtime() - start_time;
+    MPI_Reduce(&total_time, &spent_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm_cart);
+
     if (rank == 0) {
-      img_dims[0] = global_image.width;
-      img_dims[1] = global_image.height;
+      free_image(global_image);
+      global_image = cached_image;
     }
-    MPI_Bcast(img_dims, 2, MPI_INT, 0, comm_cart);
+  } else {
+    // transform image
 
-    // calculate local dimensions
-    int local_width = img_dims[0] / mpi_dims[0];
-    int local_height = img_dims[1] / mpi_dims[1];
-    int rem_width = img_dims[0] % mpi_dims[0];
-    int rem_height = img_dims[1] % mpi_dims[1];
+    // broadcast image size
+    MPI_Bcast(img_dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
 
-    if (mpi_dims[0] == cart_loc[0]+1) {
-      local_width += img_dims[0] % mpi_dims[0];
+    // grid, kernel and border exchange
+    blur_config_t config;
+    if (tune) {
+      config = autotune_blur_config(img_dims[0], img_dims[1], pixel_format,
+                                    in_place, MPI_COMM_WORLD);
+    } else {
+      config = default_blur_config(world);
+      if (in_place) {
+        config.kernel = KERNEL_IN_PLACE;
+      }
     }
-    if (mpi_dims[1] == cart_loc[1]+1) {
-      local_height += img_dims[1] % mpi_dims[1];
+    // with tuning the FFT only takes over from the measured kernel radius on
+    bool use_fft = fft;
+    if (fft && tune) {
+      int fft_radius = autotune_fft_radius(config, img_dims[0], img_dims[1],
+                                           pixel_format, MPI_COMM_WORLD);
+      use_fft = fft_radius > 0 && kernel_offset * reps >= fft_radius;
     }
+    // the border has to hold all fused iterations and the halo of the chain
+    int border = MAX(kernel_offset * config.fused_iterations,
+                     filter_chain_halo(chain));
+    // the borders only come from the direct neighbours, whose tiles have to
+    // be at least as deep as the border; the first tiles are the smallest
+    int min_offset, min_width, min_height;
+    tile_range(img_dims[0], config.dims[0], 0, &min_offset, &min_width);
+    tile_range(img_dims[1], config.dims[1], 0, &min_offset, &min_height);
+    if (min_width < border || min_height < border) {
+      if (rank == 0) {
+        fprintf(stderr,
+                "The smallest tile of %dx%d pixels on %dx%d ranks is less "
+                "than the %d pixels the blur and the chain read around it\n",
+                min_width, min_height, config.dims[0], config.dims[1],
+                border);
+      }
+      MPI_Finalize();
+      return 1;
+    }
+
+    MPI_Status status;
+    // setup cart-communicator
+    int mpi_dims[2] = {config.dims[0], config.dims[1]};
+    MPI_Comm comm_cart;
+    int cart_rank;
+    MPI_Cart_create(MPI_COMM_WORLD, 2, mpi_dims, (int[2]){0, 0}, 0, &comm_cart);
+    MPI_Comm_rank(MPI_COMM_WORLD, &cart_rank);
+    int cart_loc[2];
+    MPI_Cart_coords(comm_cart, rank, 2, cart_loc);
+
+    // calculate local dimensions
+    int local_offset_x, local_offset_y, local_width, local_height;
+    tile_range(img_dims[0], mpi_dims[0], cart_loc[0], &local_offset_x,
+               &local_width);
+    tile_range(img_dims[1], mpi_dims[1], cart_loc[1], &local_offset_y,
+               &local_height);
+    // the last column of the grid holds the widest tiles
+    int max_offset_x, max_width;
+    tile_range(img_dims[0], mpi_dims[0], mpi_dims[0] - 1, &max_offset_x,
+               &max_width);
     int send_width = local_width + 2 * kernel_offset;
     int send_height = local_height + 2 * kernel_offset;
-    int send_count = send_width * send_height * 3;
+    int pixel_size = PIXEL_SIZE(pixel_format);
+    // the tiles are transferred in strips of rows, a buffer holds one strip.
+    // Strips read from the tiled input span whole tile rows of the file, so
+    // that no tile is read twice.
+    int strip_height = TRANSFER_STRIP_HEIGHT;
+    if (input_format == FORMAT_TILED) {
+      strip_height = MAX(TRANSFER_STRIP_HEIGHT / input_tile_height, 1) *
+                     input_tile_height;
+    }
+    int send_count = send_width * strip_height * pixel_size;
     image_buffer_t img_buffer = (unsigned char *)malloc(send_count);
     // allocate local image
-    image_t local_img =
-        malloc_image_uninitialized(local_width, local_height, kernel_offset);
+    image_t local_img = malloc_image_uninitialized(local_width, local_height,
+                                                   border, pixel_format);
 
     // broadcast image
-    if (rank == 0) {
-      int max_send_width = local_width + rem_width + 2*kernel_offset;
-      int max_send_height = local_height + rem_height + 2*kernel_offset;
-      int max_send_count = max_send_width * max_send_height * 3;
+    if (input_format == FORMAT_TILED) {
+      // read the own tile including the border
+      TRACE_BEGIN(TRACE_IO);
+      PERF_BEGIN(PERF_PHASE_IO);
+      for (int strip = 0; strip < send_height;) {
+        // up to the next strip boundary of the file, rows above the image
+        // end at its upper edge
+        int file_y = local_offset_y - kernel_offset + strip;
+        int next_y = file_y < 0 ? 0
+                                : (file_y / strip_height + 1) * strip_height;
+        int rows = MIN(next_y - file_y, send_height - strip);
+        int err = tiled_read_region("MARBLES.PGT",
+                                    local_offset_x - kernel_offset, file_y,
+                                    send_width, rows, pixel_format,
+                                    img_buffer);
+        if (err) {
+          printf("Tiled Load Error: %u\n", err);
+          MPI_Abort(comm_cart, 1);
+        }
+        image_from_buffer(img_buffer, send_width, rows, -kernel_offset,
+                          strip - kernel_offset, local_img);
+        strip += rows;
+      }
+      PERF_END(PERF_PHASE_IO, (long)send_width * send_height);
+      TRACE_END(TRACE_IO, -1);
+    } else if (rank == 0) {
+      int max_send_width = max_width + 2*kernel_offset;
+      int max_send_count = max_send_width * TRANSFER_STRIP_HEIGHT * pixel_size;
       image_buffer_t img_send_buffer = (unsigned char *)malloc(max_send_count);
 
       for (int i = 0; i < mpi_dims[0]; i++) {
@@ -165,232 +496,233 @@ int main(int argc, char *argv[]) {
             continue;
           }
           int target_rank = i * mpi_dims[1] + j;
-          int offset_x = local_width * i - kernel_offset;
-          int offset_y = local_height * j - kernel_offset;
-          int target_width = local_width;
-          int target_height = local_height;
-          if (i + 1 == mpi_dims[0]) {
-            target_width += rem_width;
-          }
-          if (j + 1 == mpi_dims[1]) {
-            target_height += rem_height;
-          }
+          int offset_x, offset_y, target_width, target_height;
+          tile_range(img_dims[0], mpi_dims[0], i, &offset_x, &target_width);
+          tile_range(img_dims[1], mpi_dims[1], j, &offset_y, &target_height);
+          offset_x -= kernel_offset;
+          offset_y -= kernel_offset;
           int target_send_width = target_width + 2 * kernel_offset;
           int target_send_height = target_height + 2 * kernel_offset;
-          int target_send_count = target_send_width * target_send_height * 3;
 
-          // load the image-region into the buffer
-          buffer_from_image(global_image, target_send_width, target_send_height, offset_x, offset_y, img_send_buffer);
-          // send the buffer
-          MPI_Send(img_send_buffer, target_send_count, MPI_UNSIGNED_CHAR, target_rank, 0, comm_cart);
+          for (int strip = 0; strip < target_send_height;
+               strip += TRANSFER_STRIP_HEIGHT) {
+            int rows = MIN(TRANSFER_STRIP_HEIGHT, target_send_height - strip);
+            // load the image-region into the buffer
+            buffer_from_image(global_image, target_send_width, rows, offset_x, offset_y + strip, img_send_buffer);
+            // send the buffer
+            TRACE_BEGIN(TRACE_SEND);
+            MPI_Send(img_send_buffer, target_send_width * rows * pixel_size, MPI_UNSIGNED_CHAR, target_rank, 0, comm_cart);
+            TRACE_END(TRACE_SEND, target_rank);
+          }
         }
       }
       // extract local image for rank0
-      buffer_from_image(global_image, send_width, send_height, -kernel_offset,
-                        -kernel_offset, img_send_buffer);
-      image_from_buffer(img_send_buffer, send_width, send_height, -kernel_offset, -kernel_offset, local_img);
+      for (int strip = 0; strip < send_height; strip += TRANSFER_STRIP_HEIGHT) {
+        int rows = MIN(TRANSFER_STRIP_HEIGHT, send_height - strip);
+        buffer_from_image(global_image, send_width, rows, -kernel_offset,
+                          strip - kernel_offset, img_send_buffer);
+        image_from_buffer(img_send_buffer, send_width, rows, -kernel_offset, strip - kernel_offset, local_img);
+      }
       free(img_send_buffer);
     } else {
-      MPI_Recv(img_buffer, send_count, MPI_UNSIGNED_CHAR,
-               0, // recv from rank0
-               0, comm_cart, &status);
-      image_from_buffer(img_buffer, send_width, send_height, -kernel_offset,
-                        -kernel_offset, local_img);
+      for (int strip = 0; strip < send_height; strip += TRANSFER_STRIP_HEIGHT) {
+        int rows = MIN(TRANSFER_STRIP_HEIGHT, send_height - strip);
+        TRACE_BEGIN(TRACE_RECV);
+        MPI_Recv(img_buffer, send_width * rows * pixel_size, MPI_UNSIGNED_CHAR,
+                 0, // recv from rank0
+                 0, comm_cart, &status);
+        TRACE_END(TRACE_RECV, 0);
+        image_from_buffer(img_buffer, send_width, rows, -kernel_offset,
+                          strip - kernel_offset, local_img);
+      }
     }
 
-    // convert buffer to image
-    image_t local_img_out = malloc_image_uninitialized(
-        local_img.width, local_img.height, local_img.border);
+    free(img_buffer);
 
-    // initialize border-send- and recv- buffers
-    int border_max_send_count;
-    if (local_width < local_height) {
-      border_max_send_count = local_height;
-    } else {
-      border_max_send_count = local_width;
+    // the in-place kernel works without a second image, the chain does not
+    bool second_image =
+        (config.kernel != KERNEL_IN_PLACE && !use_fft) || chain.length > 0;
+    image_t local_img_out = {0};
+    if (second_image) {
+      local_img_out =
+          malloc_image_uninitialized(local_img.width, local_img.height,
+                                     local_img.border, local_img.format);
     }
-    border_max_send_count += 2 * kernel_offset;
-    border_max_send_count *= 3 * kernel_offset;
+
+    // initialize border-send- and recv- buffers
+    int border_max_send_count =
+        border_buffer_size(local_width, local_height, border, pixel_format);
     image_buffer_t border_send_buffer =
         (unsigned char *)malloc(border_max_send_count);
     image_buffer_t border_recv_buffer =
         (unsigned char *)malloc(border_max_send_count);
 
-    double start_time = MPI_Wtime();
-
-    int corner_border_send_recv_count = local_img.border * local_img.border * 3;
-    int upper_lower_border_send_recv_count = local_img.width * local_img.border * 3;
-    int left_right_border_send_recv_count = local_img.height * local_img.border * 3;
-    int maximum_x = mpi_dims[0] - 1;
-    int maximum_y = mpi_dims[1] - 1;
-    int current_x = cart_loc[0];
-    int current_y = cart_loc[1];
-
-    // apply filters locally and exchange borders
-    for (int i = 0; i < reps; i++) {
-
-      compute_gaussian_blur(local_img.data, local_height, local_width,
-                            local_img_out.data);
-
-      image_t tmp_img = local_img;
-      local_img = local_img_out;
-      local_img_out = tmp_img;
-
-      /*
-        The border pixel information for all eight neighbours must be exchanged
-      */
-
-      // upper lower border exchange
-      for (int k = 0; k <= 1; k++) {
-        int x_start = local_img.border;
-        int x_end = local_img.border + local_img.width - 1;
-        if ((current_y + k) % 2) {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, 0, -1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, x_start, local_img.border, x_end, 2 * local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, x_start, 0, x_end, local_img.border - 1, border_recv_buffer);
-          }
-        } else {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, 0, +1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, x_start, local_img.height, x_end, local_img.height + local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, upper_lower_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, x_start, local_img.height + local_img.border, x_end, local_img.height + 2 * local_img.border - 1, border_recv_buffer); 
-          }
-        }
-      }
-
-      // left right border exchange
-      for (int k = 0; k <= 1; k++) {
-        int y_start = local_img.border;
-        int y_end = local_img.border + local_img.height - 1;
-        if ((current_x + k) % 2) {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, 0);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.border, y_start, 2 * local_img.border - 1, y_end, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, 0, y_start, local_img.border - 1, y_end, border_recv_buffer);
-          }
-        } else {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, 0);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.width, y_start, local_img.width + local_img.border - 1, y_end, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, left_right_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, local_img.width + local_img.border, y_start, local_img.width + 2 * local_img.border - 1, y_end, border_recv_buffer);
-          }
-        }
-      }
+    // the image was distributed with a border of kernel_offset pixels
+    if (border > kernel_offset) {
+      exchange_borders(local_img, mpi_dims[0] - 1, mpi_dims[1] - 1,
+                       cart_loc[0], cart_loc[1], border_send_buffer,
+                       border_recv_buffer, comm_cart);
+    }
 
-      // upper left right lower border exchange
-      for (int k = 0; k <= 1; k++) {
-        if ((current_x + k) % 2) {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, -1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.border, local_img.border, 2 * local_img.border - 1, 2 * local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, 0, 0, local_img.border - 1, local_img.border - 1, border_recv_buffer);
-          }
-        } else {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, +1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.width, local_img.height, local_img.width + local_img.border - 1, local_img.height + local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, local_img.width + local_img.border, local_img.height + local_img.border, local_img.width + 2 * local_img.border - 1, local_img.height + 2 * local_img.border - 1, border_recv_buffer);
-          }
-        }
-      }
+    double start_time = MPI_Wtime();
 
-      // lower left right upper border exchange
-      for (int k = 0; k <= 1; k++) {
-        if ((current_x + k) % 2) {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, -1, +1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.border, local_img.height, 2 * local_img.border - 1, local_img.height + local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, 0, local_img.height + local_img.border, local_img.border - 1, local_img.height + 2 * local_img.border - 1, border_recv_buffer);
-          }
-        } else {
-          int other_rank = get_other_rank(maximum_x, maximum_y, current_x, current_y, +1, -1);
-          if (other_rank != MPI_PROC_NULL) {
-            copy_image_part_to_buffer(local_img, local_img.width, local_img.border, local_img.width + local_img.border - 1, 2 * local_img.border - 1, border_send_buffer);
-            MPI_Sendrecv(border_send_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, border_recv_buffer, corner_border_send_recv_count, MPI_UNSIGNED_CHAR, other_rank, COMM_TAG, comm_cart, MPI_STATUS_IGNORE);
-            apply_image_part_from_buffer(local_img, local_img.width + local_img.border, 0, local_img.width + 2 * local_img.border - 1, local_img.border - 1, border_recv_buffer);
-          }
-        }
-      }
+    if (use_fft) {
+      fft_blur(local_img, reps, img_dims[0], img_dims[1], mpi_dims, comm_cart);
+      exchange_borders(local_img, mpi_dims[0] - 1, mpi_dims[1] - 1,
+                       cart_loc[0], cart_loc[1], border_send_buffer,
+                       border_recv_buffer, comm_cart);
+    } else {
+      // apply filters locally and exchange borders
+      blur_iterations(&local_img, &local_img_out, reps, config, cart_loc,
+                      border_send_buffer, border_recv_buffer, comm_cart);
     }
 
     double total_time = MPI_Wtime() - start_time;
     MPI_Reduce(&total_time, &spent_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm_cart);
 
+    if (chain.length > 0) {
+      double chain_start_time = MPI_Wtime();
+      filter_chain_step(chain, &local_img, &local_img_out, mpi_dims, cart_loc,
+                        border_send_buffer, border_recv_buffer, comm_cart);
+      double chain_total_time = MPI_Wtime() - chain_start_time;
+      MPI_Reduce(&chain_total_time, &chain_time, 1, MPI_DOUBLE, MPI_MAX, 0,
+                 comm_cart);
+    }
+
     free(border_send_buffer);
     free(border_recv_buffer);
-    free_image(local_img_out);
-
-    // collect image parts
-    if (rank == 0) {
-      int max_send_width = local_width + rem_width;
-      int max_send_height = local_height + rem_height;
-      int max_send_count = max_send_width * max_send_height * 3;
-      image_buffer_t img_send_buffer = (unsigned char *)malloc(max_send_count);
+    if (second_image) {
+      free_image(local_img_out);
+    }
 
-      for (int i = 0; i < mpi_dims[0]; i++) {
-        for (int j = 0; j < mpi_dims[1]; j++) {
-          if (i == 0 && j == 0) {
-            continue;
-          }
-          int target_rank = i * mpi_dims[1] + j;
-          int offset_x = local_width * i;
-          int offset_y = local_height * j;
-          int target_width = local_width;
-          int target_height = local_height;
-          if (i + 1 == mpi_dims[0]) {
-            target_width += rem_width;
-          }
-          if (j + 1 == mpi_dims[1]) {
-            target_height += rem_height;
+    if (format == FORMAT_QOI) {
+      // every rank compresses and writes its own rows
+      TRACE_BEGIN(TRACE_IO);
+      PERF_BEGIN(PERF_PHASE_IO);
+      int err = qoi_write_file_parallel("MARBLES2.QOI", local_img,
+                                        local_offset_y, img_dims[0],
+                                        img_dims[1], mpi_dims, cart_loc,
+                                        comm_cart);
+      if (err && rank == 0) {
+        printf("QOI Save Error: %u\n", err);
+      }
+      PERF_END(PERF_PHASE_IO, (long)local_width * local_height);
+      TRACE_END(TRACE_IO, -1);
+      output_saved = true;
+    } else if (format == FORMAT_TILED) {
+      // every rank writes its own part of the file tiles
+      TRACE_BEGIN(TRACE_IO);
+      PERF_BEGIN(PERF_PHASE_IO);
+      int err = tiled_write_file_parallel("MARBLES2.PGT", local_img,
+                                          local_offset_x, local_offset_y,
+                                          img_dims[0], img_dims[1],
+                                          TILED_DEFAULT_TILE_SIZE, comm_cart);
+      if (err && rank == 0) {
+        printf("Tiled Save Error: %u\n", err);
+      }
+      PERF_END(PERF_PHASE_IO, (long)local_width * local_height);
+      TRACE_END(TRACE_IO, -1);
+      output_saved = true;
+    } else {
+      // collect image parts
+      if (rank == 0) {
+        int max_send_width = max_width;
+        int max_send_count = max_send_width * TRANSFER_STRIP_HEIGHT * pixel_size;
+        image_buffer_t img_send_buffer = (unsigned char *)malloc(max_send_count);
+
+        for (int i = 0; i < mpi_dims[0]; i++) {
+          for (int j = 0; j < mpi_dims[1]; j++) {
+            if (i == 0 && j == 0) {
+              continue;
+            }
+            int target_rank = i * mpi_dims[1] + j;
+            int offset_x, offset_y, target_width, target_height;
+            tile_range(img_dims[0], mpi_dims[0], i, &offset_x, &target_width);
+            tile_range(img_dims[1], mpi_dims[1], j, &offset_y,
+                       &target_height);
+
+            for (int strip = 0; strip < target_height;
+                 strip += TRANSFER_STRIP_HEIGHT) {
+              int rows = MIN(TRANSFER_STRIP_HEIGHT, target_height - strip);
+              TRACE_BEGIN(TRACE_RECV);
+              MPI_Recv(img_send_buffer, target_width * rows * pixel_size, MPI_UNSIGNED_CHAR, target_rank, 0, comm_cart, &status);
+              TRACE_END(TRACE_RECV, target_rank);
+              // load the image-region into the buffer
+              image_from_buffer(img_send_buffer, target_width, rows, offset_x, offset_y + strip, global_image);
+            }
           }
-          int target_count = target_width * target_height * 3;
-
-          MPI_Recv(img_send_buffer, target_count, MPI_UNSIGNED_CHAR, target_rank, 0, comm_cart, &status);
-          // load the image-region into the buffer
-          image_from_buffer(img_send_buffer, target_width, target_height, offset_x, offset_y, global_image);
         }
+        // integrate own image
+        for (int strip = 0; strip < local_height;
+             strip += TRANSFER_STRIP_HEIGHT) {
+          int rows = MIN(TRANSFER_STRIP_HEIGHT, local_height - strip);
+          buffer_from_image(local_img, local_width, rows, 0, strip,
+                            img_send_buffer);
+          image_from_buffer(img_send_buffer, local_width, rows, 0, strip,
+                            global_image);
+        }
+        free(img_send_buffer);
+      } else {
+        img_buffer = (unsigned char *)malloc(local_width *
+                                             TRANSFER_STRIP_HEIGHT * pixel_size);
+        for (int strip = 0; strip < local_height;
+             strip += TRANSFER_STRIP_HEIGHT) {
+          int rows = MIN(TRANSFER_STRIP_HEIGHT, local_height - strip);
+          buffer_from_image(local_img, local_width, rows, 0, strip, img_buffer);
+          TRACE_BEGIN(TRACE_SEND);
+          MPI_Send(img_buffer, local_width * rows * pixel_size,
+                   MPI_UNSIGNED_CHAR, 0, 0, comm_cart);
+          TRACE_END(TRACE_SEND, 0);
+        }
+        free(img_buffer);
       }
-      // integrate own image
-      buffer_from_image(local_img, local_width, local_height, 0, 0, img_buffer);
-      image_from_buffer(img_buffer, local_width, local_height, 0, 0,
-                        global_image);
-      free(img_send_buffer);
-    } else {
-      buffer_from_image(local_img, local_width, local_height, 0, 0, img_buffer);
-      MPI_Send(img_buffer, local_width * local_height * 3, MPI_UNSIGNED_CHAR, 0,
-               0, comm_cart);
     }
 
-    free(img_buffer);
+    // reduce the blurred image to the coarser levels of the pyramid
+    if (pyramid_levels > 0) {
+      pyramid = (image_t *)malloc(sizeof(image_t) * pyramid_levels);
+      double pyramid_start_time = MPI_Wtime();
+      pyramid_built = build_pyramid(local_img, local_offset_x, local_offset_y,
+                                    img_dims[0], img_dims[1], pyramid_levels,
+                                    mpi_dims, cart_loc, comm_cart, pyramid);
+      double pyramid_total_time = MPI_Wtime() - pyramid_start_time;
+      MPI_Reduce(&pyramid_total_time, &pyramid_time, 1, MPI_DOUBLE, MPI_MAX,
+                 0, comm_cart);
+    }
   }
 
 
   // save image
   if (rank == 0) {
-    int width = global_image.width;
-    int height = global_image.height;
-
-    // convert image buffer
-    buffer_from_image(global_image, width, height, 0, 0, global_buffer);
-
-    // save image buffer
-    int err = loadbmp_encode_file("MARBLES2.BMP", global_buffer, width, height,
-                                  LOADBMP_RGB);
-    if (err) {
-      printf("LoadBMP Save Error: %u\n", err);
+    if (!output_saved) {
+      TRACE_BEGIN(TRACE_IO);
+      PERF_BEGIN(PERF_PHASE_IO);
+      save_image("MARBLES2", format, global_image);
+      PERF_END(PERF_PHASE_IO, (long)global_image.width * global_image.height);
+      TRACE_END(TRACE_IO, -1);
     }
     printf("%d,%d,%lf\n", world, reps, spent_time);
+
+    // save pyramid levels
+    for (int level = 1; level <= pyramid_built; level++) {
+      char name[32];
+      snprintf(name, sizeof(name), "MARBLES2_L%d", level);
+      save_image(name, format, pyramid[level - 1]);
+      free_image(pyramid[level - 1]);
+    }
+    if (pyramid_levels > 0) {
+      printf("pyramid,%d,%lf\n", pyramid_built, pyramid_time);
+    }
+    if (chain.length > 0) {
+      printf("chain,%lf\n", chain_time);
+    }
     free(global_buffer);
     free_image(global_image);
   }
+  free(pyramid);
+  free(dirty);
+  PERF_REPORT(MPI_COMM_WORLD);
+  TRACE_FINISH(MPI_COMM_WORLD);
   MPI_Finalize();
   return 0;
 }
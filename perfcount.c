@@ -0,0 +1,340 @@
+
+#include "perfcount.h"
+
+#ifdef PERF_COUNTERS
+
+#include <errno.h>
+#include <stdbool.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_VECTOR,
+  PERF_COUNTER_COUNT
+} perf_counter_t;
+
+static const char *counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "L1d-misses", "LLC-misses", "vector"};
+static const char *phase_names[PERF_PHASE_COUNT] = {"blur", "pack", "io"};
+
+// arithmetic operations per sample of the kernel variants: 25 taps * 2 in
+// double precision, or a horizontal and a vertical pass of 5 integer taps * 2
+static const double kernel_operations[KERNEL_VARIANT_COUNT] = {50.0, 20.0,
+                                                               20.0};
+static const bool kernel_floating_point[KERNEL_VARIANT_COUNT] = {true, false,
+                                                                 false};
+// samples per pixel of the processed images
+static int channels = 3;
+
+#define CACHE_LINE_SIZE (64)
+// bytes of independent accumulators in the peak measurements: enough vector
+// registers to hide the latency of the operations, few enough to stay in them
+#define PEAK_ACCUMULATOR_BYTES (128)
+#define PEAK_DOUBLE_LANES (PEAK_ACCUMULATOR_BYTES / (int)sizeof(double))
+#define PEAK_INT_LANES (PEAK_ACCUMULATOR_BYTES / (int)sizeof(unsigned int))
+
+// per phase: counters, seconds, pixels, floating point and integer operations
+#define PHASE_VALUES (PERF_COUNTER_COUNT + 4)
+// all phases plus bandwidth and both peak operation rates of the roofline
+#define RANK_VALUES (PERF_PHASE_COUNT * PHASE_VALUES + 3)
+
+static int counter_fds[PERF_COUNTER_COUNT];
+static double phase_counters[PERF_PHASE_COUNT][PERF_COUNTER_COUNT];
+static double phase_seconds[PERF_PHASE_COUNT];
+static double phase_pixels[PERF_PHASE_COUNT];
+static double phase_flops[PERF_PHASE_COUNT];
+static double phase_int_ops[PERF_PHASE_COUNT];
+static double phase_start_counters[PERF_PHASE_COUNT][PERF_COUNTER_COUNT];
+static double phase_start_time[PERF_PHASE_COUNT];
+static double roofline_bandwidth; // bytes per second
+static double roofline_flops;     // floating point operations per second
+static double roofline_int_ops;   // integer operations per second
+
+static int open_counter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // user space only, allowed without root up to perf_event_paranoid 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * value of a counter, scaled up if the kernel had to multiplex it.
+ */
+static double read_counter(int fd) {
+  uint64_t values[3];
+  if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) ||
+      values[2] == 0) {
+    return 0.0;
+  }
+  return (double)values[0] * ((double)values[1] / (double)values[2]);
+}
+
+static double measure_bandwidth(void) {
+  long n = 4 * 1024 * 1024;
+  double *a = (double *)malloc(sizeof(double) * n);
+  double *b = (double *)malloc(sizeof(double) * n);
+  double *c = (double *)malloc(sizeof(double) * n);
+  for (long i = 0; i < n; i++) {
+    a[i] = 0.0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+  double best = 0.0;
+  for (int rep = 0; rep < 3; rep++) {
+    double start_time = MPI_Wtime();
+    for (long i = 0; i < n; i++) {
+      a[i] = b[i] + 0.5 * c[i];
+    }
+    double seconds = MPI_Wtime() - start_time;
+    double bandwidth = 3.0 * sizeof(double) * n / seconds;
+    if (bandwidth > best) {
+      best = bandwidth;
+    }
+  }
+  // keep the compiler from dropping the loop
+  if (a[n / 2] != 2.0) {
+    fprintf(stderr, "perf: bandwidth measurement failed\n");
+  }
+  free(a);
+  free(b);
+  free(c);
+  return best;
+}
+
+static double measure_flops(void) {
+  long n = 1024 * 1024;
+  volatile double seed = 1.0;
+  // a multiply-add on every lane, the lanes do not depend on each other
+  double lanes[PEAK_DOUBLE_LANES];
+  for (int k = 0; k < PEAK_DOUBLE_LANES; k++) {
+    lanes[k] = seed + k;
+  }
+  double start_time = MPI_Wtime();
+  for (long i = 0; i < n; i++) {
+    for (int k = 0; k < PEAK_DOUBLE_LANES; k++) {
+      lanes[k] = lanes[k] * 0.999999 + 1e-7;
+    }
+  }
+  double seconds = MPI_Wtime() - start_time;
+  double sum = 0.0;
+  for (int k = 0; k < PEAK_DOUBLE_LANES; k++) {
+    sum += lanes[k];
+  }
+  seed = sum;
+  return 2.0 * PEAK_DOUBLE_LANES * n / seconds;
+}
+
+static double measure_int_ops(void) {
+  long n = 1024 * 1024;
+  volatile unsigned int seed = 1;
+  // the same for the integer multiply-adds of the separable kernels
+  unsigned int lanes[PEAK_INT_LANES];
+  for (int k = 0; k < PEAK_INT_LANES; k++) {
+    lanes[k] = seed + k;
+  }
+  double start_time = MPI_Wtime();
+  for (long i = 0; i < n; i++) {
+    for (int k = 0; k < PEAK_INT_LANES; k++) {
+      lanes[k] = lanes[k] * 6u + 4u;
+    }
+  }
+  double seconds = MPI_Wtime() - start_time;
+  unsigned int sum = 0;
+  for (int k = 0; k < PEAK_INT_LANES; k++) {
+    sum += lanes[k];
+  }
+  seed = sum;
+  return 2.0 * PEAK_INT_LANES * n / seconds;
+}
+
+void perf_init(void) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  counter_fds[PERF_CYCLES] =
+      open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  counter_fds[PERF_INSTRUCTIONS] =
+      open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  counter_fds[PERF_L1D_MISSES] = open_counter(
+      PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  counter_fds[PERF_LLC_MISSES] =
+      open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  counter_fds[PERF_VECTOR] = -1;
+  const char *vector_event = getenv("P2_PERF_VECTOR_EVENT");
+  if (vector_event != NULL && vector_event[0] == 'r') {
+    counter_fds[PERF_VECTOR] =
+        open_counter(PERF_TYPE_RAW, strtoull(vector_event + 1, NULL, 16));
+  }
+
+  if (counter_fds[PERF_CYCLES] < 0 && rank == 0) {
+    int paranoid = -1;
+    FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if (f != NULL) {
+      if (fscanf(f, "%d", &paranoid) != 1) {
+        paranoid = -1;
+      }
+      fclose(f);
+    }
+    fprintf(stderr,
+            "perf: counters unavailable (%s, perf_event_paranoid=%d), "
+            "only reporting times\n",
+            strerror(errno), paranoid);
+  }
+
+  roofline_bandwidth = measure_bandwidth();
+  roofline_flops = measure_flops();
+  roofline_int_ops = measure_int_ops();
+}
+
+void perf_set_channels(int image_channels) {
+  channels = image_channels;
+}
+
+void perf_begin(perf_phase_t phase) {
+  for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+    phase_start_counters[phase][c] = read_counter(counter_fds[c]);
+  }
+  phase_start_time[phase] = MPI_Wtime();
+}
+
+void perf_end(perf_phase_t phase, long pixels) {
+  phase_seconds[phase] += MPI_Wtime() - phase_start_time[phase];
+  for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+    phase_counters[phase][c] +=
+        read_counter(counter_fds[c]) - phase_start_counters[phase][c];
+  }
+  phase_pixels[phase] += (double)pixels;
+}
+
+void perf_end_kernel(perf_phase_t phase, long pixels,
+                     kernel_variant_t kernel) {
+  perf_end(phase, pixels);
+  double operations = kernel_operations[kernel] * channels * (double)pixels;
+  if (kernel_floating_point[kernel]) {
+    phase_flops[phase] += operations;
+  } else {
+    phase_int_ops[phase] += operations;
+  }
+}
+
+/**
+ * print the rate of operations of a phase and the rate the roofline allows,
+ * bounded by the traffic to memory if it is known.
+ */
+static void print_operations(const char *unit, double operations,
+                             double bytes, double seconds, double bandwidth,
+                             double peak) {
+  if (operations <= 0.0) {
+    return;
+  }
+  double attainable = peak;
+  if (bytes > 0.0) {
+    double intensity = operations / bytes;
+    if (intensity * bandwidth < attainable) {
+      attainable = intensity * bandwidth;
+    }
+    fprintf(stderr, " AI=%.2lf", intensity);
+  }
+  fprintf(stderr, " %s=%.2lf/%.2lf", unit, operations / seconds * 1e-9,
+          attainable * 1e-9);
+}
+
+static void print_rank(int rank, double *values) {
+  double bandwidth = values[RANK_VALUES - 3];
+  double peak_flops = values[RANK_VALUES - 2];
+  double peak_int_ops = values[RANK_VALUES - 1];
+  fprintf(stderr,
+          "perf: rank %d roofline %.2lf GB/s %.2lf GFLOP/s %.2lf GOP/s\n",
+          rank, bandwidth * 1e-9, peak_flops * 1e-9, peak_int_ops * 1e-9);
+  for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+    double *phase_values = &values[p * PHASE_VALUES];
+    double seconds = phase_values[PERF_COUNTER_COUNT];
+    double pixels = phase_values[PERF_COUNTER_COUNT + 1];
+    if (pixels == 0.0) {
+      continue;
+    }
+    fprintf(stderr, "perf: rank %d %-5s %10.6lfs %12.0lf px", rank,
+            phase_names[p], seconds, pixels);
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+      if (counter_fds[c] >= 0) {
+        fprintf(stderr, " %s=%.0lf", counter_names[c], phase_values[c]);
+      }
+    }
+
+    // derived metrics
+    double cycles = phase_values[PERF_CYCLES];
+    double bytes = phase_values[PERF_LLC_MISSES] * CACHE_LINE_SIZE;
+    double flops = phase_values[PERF_COUNTER_COUNT + 2];
+    double int_ops = phase_values[PERF_COUNTER_COUNT + 3];
+    if (cycles > 0.0) {
+      fprintf(stderr, " IPC=%.2lf", phase_values[PERF_INSTRUCTIONS] / cycles);
+    }
+    if (bytes > 0.0) {
+      fprintf(stderr, " bytes/px=%.2lf", bytes / pixels);
+    }
+    print_operations("GFLOP/s", flops, bytes, seconds, bandwidth, peak_flops);
+    print_operations("GOP/s", int_ops, bytes, seconds, bandwidth,
+                     peak_int_ops);
+    fprintf(stderr, "\n");
+  }
+}
+
+void perf_report(MPI_Comm comm) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+
+  double values[RANK_VALUES];
+  for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+      values[p * PHASE_VALUES + c] = phase_counters[p][c];
+    }
+    values[p * PHASE_VALUES + PERF_COUNTER_COUNT] = phase_seconds[p];
+    values[p * PHASE_VALUES + PERF_COUNTER_COUNT + 1] = phase_pixels[p];
+    values[p * PHASE_VALUES + PERF_COUNTER_COUNT + 2] = phase_flops[p];
+    values[p * PHASE_VALUES + PERF_COUNTER_COUNT + 3] = phase_int_ops[p];
+  }
+  values[RANK_VALUES - 3] = roofline_bandwidth;
+  values[RANK_VALUES - 2] = roofline_flops;
+  values[RANK_VALUES - 1] = roofline_int_ops;
+
+  double *all_values = NULL;
+  if (rank == 0) {
+    all_values = (double *)malloc(sizeof(double) * RANK_VALUES * world);
+  }
+  MPI_Gather(values, RANK_VALUES, MPI_DOUBLE, all_values, RANK_VALUES,
+             MPI_DOUBLE, 0, comm);
+  if (rank == 0) {
+    for (int r = 0; r < world; r++) {
+      print_rank(r, &all_values[r * RANK_VALUES]);
+    }
+    free(all_values);
+  }
+
+  for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+    if (counter_fds[c] >= 0) {
+      close(counter_fds[c]);
+    }
+  }
+}
+
+#endif /* PERF_COUNTERS */
@@ -0,0 +1,84 @@
+#ifndef SRC_PERFCOUNT_H_
+#define SRC_PERFCOUNT_H_
+
+/*
+ * Optional hardware performance counters around the phases of the blur.
+ *
+ * Build with PERF_COUNTERS defined (make PERF=1) to enable them, otherwise all
+ * macros expand to nothing. The counters are collected with perf_event_open
+ * for user space only, so no root is needed as long as
+ * /proc/sys/kernel/perf_event_paranoid is at most 2. There is no portable
+ * event for vector instructions, a raw event can be given in the environment
+ * variable P2_PERF_VECTOR_EVENT (e.g. r01c7 for FP_ARITH_INST_RETIRED on
+ * Intel).
+ *
+ * The arithmetic operations of the blur kernels are estimated per kernel
+ * variant, floating point and integer operations separately. Each is compared
+ * with the peak rate of its kind measured at start-up.
+ */
+
+#include "kernels.h"
+#include <mpi.h>
+
+typedef enum {
+  PERF_PHASE_BLUR, // blur kernels
+  PERF_PHASE_PACK, // copying pixels between images and buffers
+  PERF_PHASE_IO,   // loading and saving images
+  PERF_PHASE_COUNT
+} perf_phase_t;
+
+#ifdef PERF_COUNTERS
+
+/**
+ * open the counters and measure the roofline of this rank.
+ */
+void perf_init(void);
+
+/**
+ * set the number of channels of the images, used to estimate the arithmetic
+ * operations of the blur kernels. The default is 3.
+ */
+void perf_set_channels(int image_channels);
+
+/**
+ * start counting for a phase.
+ */
+void perf_begin(perf_phase_t phase);
+
+/**
+ * stop counting for a phase, which processed the given number of pixels.
+ */
+void perf_end(perf_phase_t phase, long pixels);
+
+/**
+ * same as @perf_end@, for a phase that ran a blur kernel of the given variant
+ * on the pixels, whose arithmetic operations are counted as well.
+ */
+void perf_end_kernel(perf_phase_t phase, long pixels,
+                     kernel_variant_t kernel);
+
+/**
+ * print the counters and derived metrics of all ranks on rank 0 and close the
+ * counters. Has to be called by all ranks of the communicator.
+ */
+void perf_report(MPI_Comm comm);
+
+#define PERF_INIT() perf_init()
+#define PERF_CHANNELS(channels) perf_set_channels(channels)
+#define PERF_BEGIN(phase) perf_begin(phase)
+#define PERF_END(phase, pixels) perf_end(phase, pixels)
+#define PERF_END_KERNEL(phase, pixels, kernel) perf_end_kernel(phase, pixels, kernel)
+#define PERF_REPORT(comm) perf_report(comm)
+
+#else
+
+#define PERF_INIT() ((void)0)
+#define PERF_CHANNELS(channels) ((void)0)
+#define PERF_BEGIN(phase) ((void)0)
+#define PERF_END(phase, pixels) ((void)0)
+#define PERF_END_KERNEL(phase, pixels, kernel) ((void)0)
+#define PERF_REPORT(comm) ((void)0)
+
+#endif /* PERF_COUNTERS */
+
+#endif /* SRC_PERFCOUNT_H_ */
@@ -0,0 +1,143 @@
+
+#include "pyramid.h"
+#include "distribute.h"
+#include "kernels.h"
+#include "perfcount.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+int build_pyramid(image_t local_img, int offset_x, int offset_y,
+                  int img_width, int img_height, int levels, int mpi_dims[2], int cart_loc[2],
+                  MPI_Comm comm_cart, image_t *pyramid) {
+  int rank;
+  MPI_Comm_rank(comm_cart, &rank);
+  int border = local_img.border;
+  pixel_format_t format = local_img.format;
+  int maximum_x = mpi_dims[0] - 1;
+  int maximum_y = mpi_dims[1] - 1;
+
+  int width = img_width;
+  int height = img_height;
+  image_t level_img = local_img;
+  bool owns_level_img = false;
+  bool distributed = true;
+  int built = 0;
+
+  for (int level = 1; level <= levels; level++) {
+    if (width == 1 && height == 1) {
+      break;
+    }
+    int next_width = (width + 1) / 2;
+    int next_height = (height + 1) / 2;
+
+    if (distributed) {
+      // a rank keeps the pixels with even global coordinates of its tile
+      int next_offset_x = (offset_x + 1) / 2;
+      int next_offset_y = (offset_y + 1) / 2;
+      int next_local_width =
+          (offset_x + level_img.width + 1) / 2 - next_offset_x;
+      int next_local_height =
+          (offset_y + level_img.height + 1) / 2 - next_offset_y;
+
+      // the border exchange needs at least border pixels in every tile
+      int smallest = MIN(next_local_width, next_local_height);
+      MPI_Allreduce(MPI_IN_PLACE, &smallest, 1, MPI_INT, MPI_MIN, comm_cart);
+
+      if (smallest >= border) {
+        image_t next_img =
+            malloc_image_uninitialized(next_local_width, next_local_height,
+                                       border, format);
+        PERF_BEGIN(PERF_PHASE_BLUR);
+        compute_gaussian_reduce(format, level_img.data, border,
+                                2 * next_offset_y - offset_y,
+                                2 * next_offset_x - offset_x,
+                                next_local_height, next_local_width,
+                                next_img.data);
+        // the reduction computes the stencil of the reference kernel
+        PERF_END_KERNEL(PERF_PHASE_BLUR,
+                        (long)next_local_width * next_local_height,
+                        KERNEL_REFERENCE);
+
+        int border_max_send_count =
+            border_buffer_size(next_local_width, next_local_height, border,
+                               format);
+        image_buffer_t border_send_buffer =
+            (unsigned char *)malloc(border_max_send_count);
+        image_buffer_t border_recv_buffer =
+            (unsigned char *)malloc(border_max_send_count);
+        exchange_borders(next_img, maximum_x, maximum_y, cart_loc[0],
+                         cart_loc[1], border_send_buffer, border_recv_buffer,
+                         comm_cart);
+        free(border_send_buffer);
+        free(border_recv_buffer);
+
+        image_t level_out = {0};
+        if (rank == 0) {
+          level_out =
+              malloc_image_uninitialized(next_width, next_height, border,
+                                         format);
+          pyramid[level - 1] = level_out;
+        }
+        gather_image(next_img, next_offset_x, next_offset_y, level_out,
+                     comm_cart);
+
+        if (owns_level_img) {
+          free_image(level_img);
+        }
+        level_img = next_img;
+        owns_level_img = true;
+        offset_x = next_offset_x;
+        offset_y = next_offset_y;
+        width = next_width;
+        height = next_height;
+        built = level;
+        continue;
+      }
+
+      // the coarse levels are too small to split across the grid
+      distributed = false;
+      if (level == 1) {
+        // level 0 has not been gathered yet
+        image_t level_out = {0};
+        if (rank == 0) {
+          level_out =
+              malloc_image_uninitialized(width, height, border, format);
+        }
+        gather_image(level_img, offset_x, offset_y, level_out, comm_cart);
+        level_img = level_out;
+      } else {
+        if (owns_level_img) {
+          free_image(level_img);
+        }
+        level_img = pyramid[level - 2];
+      }
+      owns_level_img = level == 1 && rank == 0;
+      if (rank != 0) {
+        break;
+      }
+    }
+
+    pyramid[level - 1] =
+        malloc_image_uninitialized(next_width, next_height, border, format);
+    PERF_BEGIN(PERF_PHASE_BLUR);
+    compute_gaussian_reduce(format, level_img.data, border, 0, 0, next_height,
+                            next_width, pyramid[level - 1].data);
+    PERF_END_KERNEL(PERF_PHASE_BLUR, (long)next_width * next_height,
+                    KERNEL_REFERENCE);
+    if (owns_level_img) {
+      free_image(level_img);
+      owns_level_img = false;
+    }
+    level_img = pyramid[level - 1];
+    width = next_width;
+    height = next_height;
+    built = level;
+  }
+
+  if (owns_level_img) {
+    free_image(level_img);
+  }
+  return built;
+}
@@ -0,0 +1,26 @@
+#ifndef SRC_PYRAMID_H_
+#define SRC_PYRAMID_H_
+
+#include "image.h"
+#include <mpi.h>
+
+/**
+ * build the levels 1..levels of a gaussian pyramid from the distributed
+ * level 0.
+ *
+ * Every level is computed by the fused blur+decimate kernel
+ * @compute_gaussian_reduce@, so only the pixels that survive the decimation
+ * are filtered. Every rank passes its tile of level 0 with up to date borders
+ * and the offset of the tile in the overall image. As long as the tiles of the
+ * next level are at least as large as the border the levels are reduced in
+ * parallel, afterwards rank 0 continues alone on the gathered level.
+ *
+ * On rank 0 pyramid[k] receives level k+1, which has to be freed by the caller
+ * with @free_image@.
+ * @return number of levels in pyramid (valid on rank 0)
+ */
+int build_pyramid(image_t local_img, int offset_x, int offset_y,
+                  int img_width, int img_height, int levels, int mpi_dims[2], int cart_loc[2],
+                  MPI_Comm comm_cart, image_t *pyramid);
+
+#endif /* SRC_PYRAMID_H_ */
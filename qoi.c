@@ -0,0 +1,305 @@
+
+#include "qoi.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_MAX_RUN 62
+
+#define QOI_HASH(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+static void write_u32(unsigned char *target, unsigned int value) {
+  target[0] = (value >> 24) & 0xff;
+  target[1] = (value >> 16) & 0xff;
+  target[2] = (value >> 8) & 0xff;
+  target[3] = value & 0xff;
+}
+
+static unsigned int read_u32(const unsigned char *source) {
+  return ((unsigned int)source[0] << 24) | ((unsigned int)source[1] << 16) |
+         ((unsigned int)source[2] << 8) | source[3];
+}
+
+void qoi_write_header(unsigned char *target, int width, int height) {
+  memcpy(target, "qoif", 4);
+  write_u32(target + 4, width);
+  write_u32(target + 8, height);
+  target[12] = 3; // channels
+  target[13] = 0; // sRGB with linear alpha
+}
+
+void qoi_write_end_marker(unsigned char *target) {
+  memset(target, 0, QOI_END_MARKER_SIZE - 1);
+  target[QOI_END_MARKER_SIZE - 1] = 1;
+}
+
+int qoi_encode_chunk(const unsigned char *pixels, int pixel_count,
+                     unsigned char *target) {
+  unsigned char index[64][3];
+  // the decoder has seen pixels of earlier chunks, only use entries of this one
+  bool index_valid[64] = {false};
+  int size = 0;
+  int run = 0;
+
+  for (int i = 0; i < pixel_count; i++) {
+    const unsigned char *px = &pixels[i * 3];
+    if (i > 0 && memcmp(px, px - 3, 3) == 0) {
+      run++;
+      if (run == QOI_MAX_RUN || i == pixel_count - 1) {
+        target[size++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      target[size++] = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    int index_pos = QOI_HASH(px[0], px[1], px[2]);
+    if (index_valid[index_pos] && memcmp(index[index_pos], px, 3) == 0) {
+      target[size++] = QOI_OP_INDEX | index_pos;
+      continue;
+    }
+    memcpy(index[index_pos], px, 3);
+    index_valid[index_pos] = true;
+
+    if (i > 0) {
+      const unsigned char *prev = px - 3;
+      signed char vr = px[0] - prev[0];
+      signed char vg = px[1] - prev[1];
+      signed char vb = px[2] - prev[2];
+      signed char vg_r = vr - vg;
+      signed char vg_b = vb - vg;
+      if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+        target[size++] =
+            QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+        continue;
+      }
+      if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 &&
+          vg_b < 8) {
+        target[size++] = QOI_OP_LUMA | (vg + 32);
+        target[size++] = (vg_r + 8) << 4 | (vg_b + 8);
+        continue;
+      }
+    }
+    target[size++] = QOI_OP_RGB;
+    target[size++] = px[0];
+    target[size++] = px[1];
+    target[size++] = px[2];
+  }
+  return size;
+}
+
+unsigned int qoi_encode_file(const char *filename, image_buffer_t buffer,
+                             int width, int height) {
+  int pixel_count = width * height;
+  unsigned char *data = (unsigned char *)malloc(
+      QOI_HEADER_SIZE + QOI_CHUNK_MAX_SIZE(pixel_count) + QOI_END_MARKER_SIZE);
+  if (!data) {
+    return QOI_OUT_OF_MEMORY;
+  }
+  qoi_write_header(data, width, height);
+  int size = QOI_HEADER_SIZE;
+  size += qoi_encode_chunk(buffer, pixel_count, data + size);
+  qoi_write_end_marker(data + size);
+  size += QOI_END_MARKER_SIZE;
+
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    free(data);
+    return QOI_FILE_OPERATION;
+  }
+  size_t written = fwrite(data, 1, size, f);
+  fclose(f);
+  free(data);
+  return written == (size_t)size ? QOI_NO_ERROR : QOI_FILE_OPERATION;
+}
+
+unsigned int qoi_decode_file(const char *filename, image_buffer_t *buffer,
+                             unsigned int *width, unsigned int *height) {
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    return QOI_FILE_NOT_FOUND;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (size < QOI_HEADER_SIZE + QOI_END_MARKER_SIZE) {
+    fclose(f);
+    return QOI_INVALID_FILE_FORMAT;
+  }
+  unsigned char *data = (unsigned char *)malloc(size);
+  if (!data) {
+    fclose(f);
+    return QOI_OUT_OF_MEMORY;
+  }
+  if (fread(data, 1, size, f) != (size_t)size) {
+    fclose(f);
+    free(data);
+    return QOI_FILE_OPERATION;
+  }
+  fclose(f);
+  if (memcmp(data, "qoif", 4) != 0) {
+    free(data);
+    return QOI_INVALID_SIGNATURE;
+  }
+
+  unsigned int w = read_u32(data + 4);
+  unsigned int h = read_u32(data + 8);
+  long pixel_count = (long)w * h;
+  unsigned char *pixels = (unsigned char *)malloc(pixel_count * 3);
+  if (!pixels) {
+    free(data);
+    return QOI_OUT_OF_MEMORY;
+  }
+
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char px[4] = {0, 0, 0, 255};
+  long p = QOI_HEADER_SIZE;
+  long end = size - QOI_END_MARKER_SIZE;
+  int run = 0;
+  for (long i = 0; i < pixel_count; i++) {
+    if (run > 0) {
+      run--;
+    } else if (p < end) {
+      int b1 = data[p++];
+      if (b1 == QOI_OP_RGB) {
+        px[0] = data[p++];
+        px[1] = data[p++];
+        px[2] = data[p++];
+      } else if (b1 == QOI_OP_RGBA) {
+        px[0] = data[p++];
+        px[1] = data[p++];
+        px[2] = data[p++];
+        px[3] = data[p++];
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+        memcpy(px, index[b1], 4);
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+        int b2 = data[p++];
+        int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
+        run = b1 & 0x3f;
+      }
+      memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px,
+             4);
+    }
+    memcpy(&pixels[i * 3], px, 3);
+  }
+  free(data);
+
+  *buffer = pixels;
+  *width = w;
+  *height = h;
+  return QOI_NO_ERROR;
+}
+
+unsigned int qoi_write_file_parallel(const char *filename, image_t local_img,
+                                     int offset_y, int img_width,
+                                     int img_height, int mpi_dims[2],
+                                     int cart_loc[2], MPI_Comm comm_cart) {
+  int rank;
+  MPI_Comm_rank(comm_cart, &rank);
+  int local_width = local_img.width;
+  int local_height = local_img.height;
+
+  // compress every row of the tile on its own
+  unsigned char *chunks =
+      (unsigned char *)malloc(QOI_CHUNK_MAX_SIZE(local_width) * local_height);
+  int *chunk_sizes = (int *)malloc(sizeof(int) * local_height);
+  image_buffer_t row_buffer =
+      (unsigned char *)malloc(local_width * PIXEL_SIZE(local_img.format));
+  image_buffer_t rgb_buffer = (unsigned char *)malloc(local_width * 3);
+  int total_size = 0;
+  for (int y = 0; y < local_height; y++) {
+    buffer_from_image(local_img, local_width, 1, 0, y, row_buffer);
+    convert_buffer(row_buffer, local_img.format, rgb_buffer, PIXEL_RGB8,
+                   local_width);
+    chunk_sizes[y] =
+        qoi_encode_chunk(rgb_buffer, local_width, chunks + total_size);
+    total_size += chunk_sizes[y];
+  }
+  free(row_buffer);
+  free(rgb_buffer);
+
+  // sizes of all chunks in file order, row by row and left to right
+  long *all_sizes = (long *)calloc((long)img_height * mpi_dims[0], sizeof(long));
+  for (int y = 0; y < local_height; y++) {
+    all_sizes[(long)(offset_y + y) * mpi_dims[0] + cart_loc[0]] =
+        chunk_sizes[y];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, all_sizes, img_height * mpi_dims[0], MPI_LONG,
+                MPI_SUM, comm_cart);
+
+  int *block_lengths = (int *)malloc(sizeof(int) * local_height);
+  MPI_Aint *displacements =
+      (MPI_Aint *)malloc(sizeof(MPI_Aint) * local_height);
+  long file_offset = QOI_HEADER_SIZE;
+  int y = 0;
+  for (long c = 0; c < (long)img_height * mpi_dims[0]; c++) {
+    if (c / mpi_dims[0] == offset_y + y && c % mpi_dims[0] == cart_loc[0] &&
+        y < local_height) {
+      block_lengths[y] = chunk_sizes[y];
+      displacements[y] = file_offset;
+      y++;
+    }
+    file_offset += all_sizes[c];
+  }
+  free(all_sizes);
+
+  MPI_File fh;
+  int err = MPI_File_open(comm_cart, filename,
+                          MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                          &fh);
+  if (err != MPI_SUCCESS) {
+    free(chunks);
+    free(chunk_sizes);
+    free(block_lengths);
+    free(displacements);
+    return QOI_FILE_OPERATION;
+  }
+  MPI_File_set_size(fh, file_offset + QOI_END_MARKER_SIZE);
+  if (rank == 0) {
+    unsigned char header[QOI_HEADER_SIZE];
+    unsigned char end_marker[QOI_END_MARKER_SIZE];
+    qoi_write_header(header, img_width, img_height);
+    qoi_write_end_marker(end_marker);
+    MPI_File_write_at(fh, 0, header, QOI_HEADER_SIZE, MPI_BYTE,
+                      MPI_STATUS_IGNORE);
+    MPI_File_write_at(fh, file_offset, end_marker, QOI_END_MARKER_SIZE,
+                      MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+
+  MPI_Datatype filetype;
+  MPI_Type_create_hindexed(local_height, block_lengths, displacements,
+                           MPI_BYTE, &filetype);
+  MPI_Type_commit(&filetype);
+  MPI_File_set_view(fh, 0, MPI_BYTE, filetype, "native", MPI_INFO_NULL);
+  err = MPI_File_write_all(fh, chunks, total_size, MPI_BYTE,
+                           MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  MPI_Type_free(&filetype);
+
+  free(chunks);
+  free(chunk_sizes);
+  free(block_lengths);
+  free(displacements);
+  return err == MPI_SUCCESS ? QOI_NO_ERROR : QOI_FILE_OPERATION;
+}
@@ -0,0 +1,77 @@
+#ifndef SRC_QOI_H_
+#define SRC_QOI_H_
+
+#include "image.h"
+#include <mpi.h>
+
+/*
+ * Lossless compression of RGB images in the QOI format (qoiformat.org).
+ *
+ * The encoder works on independent chunks of pixels: the first pixel of a
+ * chunk is always stored literally, runs end with the chunk and the color
+ * index only refers to pixels of the same chunk. Chunks of consecutive pixels
+ * can therefore be compressed in parallel and concatenated into a file that
+ * any QOI decoder reads.
+ */
+
+// Errors, same meaning as the LOADBMP errors
+#define QOI_NO_ERROR 0
+#define QOI_OUT_OF_MEMORY 1
+#define QOI_FILE_NOT_FOUND 2
+#define QOI_FILE_OPERATION 3
+#define QOI_INVALID_FILE_FORMAT 4
+#define QOI_INVALID_SIGNATURE 5
+
+#define QOI_HEADER_SIZE 14
+#define QOI_END_MARKER_SIZE 8
+
+/**
+ * upper bound of the encoded size of a chunk with the given number of pixels.
+ */
+#define QOI_CHUNK_MAX_SIZE(pixels) ((pixels) * 4)
+
+/**
+ * write the file header for an RGB image into target.
+ */
+void qoi_write_header(unsigned char *target, int width, int height);
+
+/**
+ * write the marker that ends the file into target.
+ */
+void qoi_write_end_marker(unsigned char *target);
+
+/**
+ * compress pixel_count RGB pixels into target, which has to hold
+ * @QOI_CHUNK_MAX_SIZE@ bytes.
+ * @return number of bytes written
+ */
+int qoi_encode_chunk(const unsigned char *pixels, int pixel_count,
+                     unsigned char *target);
+
+/**
+ * write an RGB buffer as one chunk into a QOI file.
+ */
+unsigned int qoi_encode_file(const char *filename, image_buffer_t buffer,
+                             int width, int height);
+
+/**
+ * read a QOI file into a newly allocated RGB buffer.
+ */
+unsigned int qoi_decode_file(const char *filename, image_buffer_t *buffer,
+                             unsigned int *width, unsigned int *height);
+
+/**
+ * write the distributed image as QOI file with MPI-IO.
+ *
+ * Other pixel formats than 8-bit RGB are converted row by row.
+ * Every rank compresses each row of its tile as a chunk of its own. The sizes
+ * are exchanged to place the chunks in row-major order, after which all ranks
+ * write their chunks with one collective write. Rank 0 adds header and end
+ * marker. Has to be called by all ranks of the communicator.
+ */
+unsigned int qoi_write_file_parallel(const char *filename, image_t local_img,
+                                     int offset_y, int img_width,
+                                     int img_height, int mpi_dims[2],
+                                     int cart_loc[2], MPI_Comm comm_cart);
+
+#endif /* SRC_QOI_H_ */
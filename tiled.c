@@ -0,0 +1,387 @@
+
+#include "tiled.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define TILED_HEADER_SIZE 28
+#define TILED_INDEX_ENTRY_SIZE 16
+
+static void write_u32(unsigned char *target, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    target[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+static void write_u64(unsigned char *target, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    target[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+static uint32_t read_u32(const unsigned char *source) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)source[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t read_u64(const unsigned char *source) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= (uint64_t)source[i] << (8 * i);
+  }
+  return value;
+}
+
+/**
+ * pread/pwrite until all bytes are transferred.
+ */
+static int pread_all(int fd, void *buffer, size_t count, off_t offset) {
+  size_t done = 0;
+  while (done < count) {
+    ssize_t n = pread(fd, (char *)buffer + done, count - done, offset + done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+static int pwrite_all(int fd, const void *buffer, size_t count, off_t offset) {
+  size_t done = 0;
+  while (done < count) {
+    ssize_t n =
+        pwrite(fd, (const char *)buffer + done, count - done, offset + done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+/**
+ * position and size of a tile, cropped to the image.
+ */
+static void tile_region(tiled_header_t header, int tx, int ty, int *x, int *y,
+                        int *width, int *height) {
+  *x = tx * header.tile_width;
+  *y = ty * header.tile_height;
+  *width = MIN(header.tile_width, header.width - *x);
+  *height = MIN(header.tile_height, header.height - *y);
+}
+
+/**
+ * header of a new file, the tiles are stored in row-major order.
+ */
+static tiled_header_t create_header(int width, int height,
+                                    pixel_format_t format, int tile_size) {
+  tiled_header_t header;
+  header.width = width;
+  header.height = height;
+  header.format = format;
+  header.tile_width = tile_size;
+  header.tile_height = tile_size;
+  header.tiles_x = (width + tile_size - 1) / tile_size;
+  header.tiles_y = (height + tile_size - 1) / tile_size;
+  int tile_count = header.tiles_x * header.tiles_y;
+  header.tile_offsets = (uint64_t *)malloc(sizeof(uint64_t) * tile_count);
+  header.tile_sizes = (uint64_t *)malloc(sizeof(uint64_t) * tile_count);
+  uint64_t offset = TILED_HEADER_SIZE + TILED_INDEX_ENTRY_SIZE * tile_count;
+  for (int ty = 0; ty < header.tiles_y; ty++) {
+    for (int tx = 0; tx < header.tiles_x; tx++) {
+      int t = ty * header.tiles_x + tx;
+      int x, y, tile_width, tile_height;
+      tile_region(header, tx, ty, &x, &y, &tile_width, &tile_height);
+      header.tile_offsets[t] = offset;
+      header.tile_sizes[t] =
+          (uint64_t)tile_width * tile_height * PIXEL_SIZE(format);
+      offset += header.tile_sizes[t];
+    }
+  }
+  return header;
+}
+
+static int write_header(int fd, tiled_header_t header) {
+  int tile_count = header.tiles_x * header.tiles_y;
+  size_t size = TILED_HEADER_SIZE + TILED_INDEX_ENTRY_SIZE * tile_count;
+  unsigned char *data = (unsigned char *)malloc(size);
+  memcpy(data, "PGT1", 4);
+  write_u32(data + 4, header.width);
+  write_u32(data + 8, header.height);
+  write_u32(data + 12, header.format.channels);
+  write_u32(data + 16, header.format.sample_type);
+  write_u32(data + 20, header.tile_width);
+  write_u32(data + 24, header.tile_height);
+  for (int t = 0; t < tile_count; t++) {
+    unsigned char *entry =
+        data + TILED_HEADER_SIZE + TILED_INDEX_ENTRY_SIZE * t;
+    write_u64(entry, header.tile_offsets[t]);
+    write_u64(entry + 8, header.tile_sizes[t]);
+  }
+  int err = pwrite_all(fd, data, size, 0);
+  free(data);
+  return err;
+}
+
+static unsigned int read_header(int fd, tiled_header_t *header) {
+  unsigned char data[TILED_HEADER_SIZE];
+  if (pread_all(fd, data, TILED_HEADER_SIZE, 0)) {
+    return TILED_INVALID_FILE_FORMAT;
+  }
+  if (memcmp(data, "PGT1", 4) != 0) {
+    return TILED_INVALID_SIGNATURE;
+  }
+  header->width = read_u32(data + 4);
+  header->height = read_u32(data + 8);
+  header->format.channels = read_u32(data + 12);
+  header->format.sample_type = read_u32(data + 16);
+  header->tile_width = read_u32(data + 20);
+  header->tile_height = read_u32(data + 24);
+  if (!pixel_format_valid(header->format) || header->tile_width <= 0 ||
+      header->tile_height <= 0) {
+    return TILED_INVALID_FILE_FORMAT;
+  }
+  header->tiles_x = (header->width + header->tile_width - 1) / header->tile_width;
+  header->tiles_y =
+      (header->height + header->tile_height - 1) / header->tile_height;
+
+  int tile_count = header->tiles_x * header->tiles_y;
+  size_t size = TILED_INDEX_ENTRY_SIZE * tile_count;
+  unsigned char *index = (unsigned char *)malloc(size);
+  header->tile_offsets = (uint64_t *)malloc(sizeof(uint64_t) * tile_count);
+  header->tile_sizes = (uint64_t *)malloc(sizeof(uint64_t) * tile_count);
+  if (!index || !header->tile_offsets || !header->tile_sizes) {
+    free(index);
+    tiled_free_header(*header);
+    return TILED_OUT_OF_MEMORY;
+  }
+  if (pread_all(fd, index, size, TILED_HEADER_SIZE)) {
+    free(index);
+    tiled_free_header(*header);
+    return TILED_INVALID_FILE_FORMAT;
+  }
+  for (int t = 0; t < tile_count; t++) {
+    header->tile_offsets[t] = read_u64(index + TILED_INDEX_ENTRY_SIZE * t);
+    header->tile_sizes[t] = read_u64(index + TILED_INDEX_ENTRY_SIZE * t + 8);
+  }
+  free(index);
+  return TILED_NO_ERROR;
+}
+
+unsigned int tiled_read_header(const char *filename, tiled_header_t *header) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return TILED_FILE_NOT_FOUND;
+  }
+  unsigned int err = read_header(fd, header);
+  close(fd);
+  return err;
+}
+
+void tiled_free_header(tiled_header_t header) {
+  free(header.tile_offsets);
+  free(header.tile_sizes);
+}
+
+unsigned int tiled_read_region(const char *filename, int x, int y, int width,
+                               int height, pixel_format_t format,
+                               image_buffer_t buffer) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return TILED_FILE_NOT_FOUND;
+  }
+  tiled_header_t header;
+  unsigned int err = read_header(fd, &header);
+  if (err) {
+    close(fd);
+    return err;
+  }
+  int pixel_size = PIXEL_SIZE(header.format);
+  // read into the buffer directly if no conversion is needed
+  image_buffer_t region_buffer = buffer;
+  if (!pixel_format_equal(header.format, format)) {
+    region_buffer =
+        (unsigned char *)malloc((size_t)width * height * pixel_size);
+  }
+  memset(region_buffer, 0, (size_t)width * height * pixel_size);
+
+  // part of the region inside the image
+  int x_start = MAX(x, 0);
+  int y_start = MAX(y, 0);
+  int x_end = MIN(x + width, header.width);
+  int y_end = MIN(y + height, header.height);
+  unsigned char *tile_buffer = (unsigned char *)malloc(
+      (size_t)header.tile_width * header.tile_height * pixel_size);
+
+  for (int ty = y_start / header.tile_height;
+       y_start < y_end && ty <= (y_end - 1) / header.tile_height; ty++) {
+    for (int tx = x_start / header.tile_width;
+         x_start < x_end && tx <= (x_end - 1) / header.tile_width; tx++) {
+      int t = ty * header.tiles_x + tx;
+      int tile_x, tile_y, tile_width, tile_height;
+      tile_region(header, tx, ty, &tile_x, &tile_y, &tile_width, &tile_height);
+      if (header.tile_sizes[t] !=
+              (uint64_t)tile_width * tile_height * pixel_size ||
+          pread_all(fd, tile_buffer, header.tile_sizes[t],
+                    header.tile_offsets[t])) {
+        err = TILED_INVALID_FILE_FORMAT;
+        break;
+      }
+      // copy the overlap of tile and region row by row
+      int copy_x_start = MAX(x_start, tile_x);
+      int copy_x_end = MIN(x_end, tile_x + tile_width);
+      for (int row = MAX(y_start, tile_y);
+           row < MIN(y_end, tile_y + tile_height); row++) {
+        memcpy(&region_buffer[((size_t)(row - y) * width + copy_x_start - x) *
+                              pixel_size],
+               &tile_buffer[((size_t)(row - tile_y) * tile_width +
+                             copy_x_start - tile_x) *
+                            pixel_size],
+               (size_t)(copy_x_end - copy_x_start) * pixel_size);
+      }
+    }
+  }
+
+  free(tile_buffer);
+  if (region_buffer != buffer) {
+    convert_buffer(region_buffer, header.format, buffer, format,
+                   (long)width * height);
+    free(region_buffer);
+  }
+  tiled_free_header(header);
+  close(fd);
+  return err;
+}
+
+unsigned int tiled_decode_file(const char *filename, image_buffer_t *buffer,
+                               unsigned int *width, unsigned int *height,
+                               pixel_format_t *format) {
+  tiled_header_t header;
+  unsigned int err = tiled_read_header(filename, &header);
+  if (err) {
+    return err;
+  }
+  tiled_free_header(header);
+  image_buffer_t data = (unsigned char *)malloc(
+      (size_t)header.width * header.height * PIXEL_SIZE(header.format));
+  if (!data) {
+    return TILED_OUT_OF_MEMORY;
+  }
+  err = tiled_read_region(filename, 0, 0, header.width, header.height,
+                          header.format, data);
+  if (err) {
+    free(data);
+    return err;
+  }
+  *buffer = data;
+  *width = header.width;
+  *height = header.height;
+  *format = header.format;
+  return TILED_NO_ERROR;
+}
+
+unsigned int tiled_encode_file(const char *filename, image_buffer_t buffer,
+                               int width, int height, pixel_format_t format,
+                               int tile_size) {
+  int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    return TILED_FILE_OPERATION;
+  }
+  tiled_header_t header = create_header(width, height, format, tile_size);
+  int pixel_size = PIXEL_SIZE(format);
+  int err = write_header(fd, header);
+  for (int ty = 0; ty < header.tiles_y && !err; ty++) {
+    for (int tx = 0; tx < header.tiles_x && !err; tx++) {
+      int t = ty * header.tiles_x + tx;
+      int tile_x, tile_y, tile_width, tile_height;
+      tile_region(header, tx, ty, &tile_x, &tile_y, &tile_width, &tile_height);
+      for (int row = 0; row < tile_height && !err; row++) {
+        err = pwrite_all(
+            fd,
+            &buffer[((size_t)(tile_y + row) * width + tile_x) * pixel_size],
+            (size_t)tile_width * pixel_size,
+            header.tile_offsets[t] + (uint64_t)row * tile_width * pixel_size);
+      }
+    }
+  }
+  tiled_free_header(header);
+  close(fd);
+  return err ? TILED_FILE_OPERATION : TILED_NO_ERROR;
+}
+
+unsigned int tiled_write_file_parallel(const char *filename,
+                                       image_t local_img, int offset_x,
+                                       int offset_y, int img_width,
+                                       int img_height, int tile_size,
+                                       MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  tiled_header_t header =
+      create_header(img_width, img_height, local_img.format, tile_size);
+  int pixel_size = PIXEL_SIZE(local_img.format);
+
+  int err = 0;
+  if (rank == 0) {
+    int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+      err = 1;
+    } else {
+      int tile_count = header.tiles_x * header.tiles_y;
+      err = write_header(fd, header) ||
+            ftruncate(fd, header.tile_offsets[tile_count - 1] +
+                              header.tile_sizes[tile_count - 1]);
+      close(fd);
+    }
+  }
+  MPI_Bcast(&err, 1, MPI_INT, 0, comm);
+  if (err) {
+    tiled_free_header(header);
+    return TILED_FILE_OPERATION;
+  }
+
+  int fd = open(filename, O_WRONLY);
+  err = fd < 0;
+  image_buffer_t row_buffer =
+      (unsigned char *)malloc((size_t)local_img.width * pixel_size);
+  int x_end = offset_x + local_img.width;
+  int y_end = offset_y + local_img.height;
+  for (int ty = offset_y / tile_size; ty <= (y_end - 1) / tile_size && !err;
+       ty++) {
+    for (int tx = offset_x / tile_size; tx <= (x_end - 1) / tile_size && !err;
+         tx++) {
+      int t = ty * header.tiles_x + tx;
+      int tile_x, tile_y, tile_width, tile_height;
+      tile_region(header, tx, ty, &tile_x, &tile_y, &tile_width, &tile_height);
+      int copy_x_start = MAX(offset_x, tile_x);
+      int copy_width = MIN(x_end, tile_x + tile_width) - copy_x_start;
+      for (int row = MAX(offset_y, tile_y);
+           row < MIN(y_end, tile_y + tile_height) && !err; row++) {
+        buffer_from_image(local_img, copy_width, 1, copy_x_start - offset_x,
+                          row - offset_y, row_buffer);
+        err = pwrite_all(
+            fd, row_buffer, (size_t)copy_width * pixel_size,
+            header.tile_offsets[t] +
+                ((uint64_t)(row - tile_y) * tile_width + copy_x_start -
+                 tile_x) *
+                    pixel_size);
+      }
+    }
+  }
+  free(row_buffer);
+  if (fd >= 0) {
+    close(fd);
+  }
+  tiled_free_header(header);
+
+  MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, comm);
+  return err ? TILED_FILE_OPERATION : TILED_NO_ERROR;
+}
@@ -0,0 +1,99 @@
+#ifndef SRC_TILED_H_
+#define SRC_TILED_H_
+
+#include "image.h"
+#include <mpi.h>
+#include <stdint.h>
+
+/*
+ * Native tiled image format (.PGT).
+ *
+ * The image is cut into tiles of a fixed size, tiles on the right and lower
+ * edge are cropped to the image. A tile stores its pixels row by row without
+ * padding. The header is followed by an index with the offset and size of
+ * every tile, so a region can be read with one pread per tile it overlaps.
+ *
+ * Layout, all numbers little endian:
+ *   "PGT1" | u32 width | u32 height | u32 channels | u32 bytes per sample |
+ *   u32 tile width | u32 tile height |
+ *   tiles_x * tiles_y times (u64 offset, u64 size), row-major |
+ *   tile data
+ *
+ * Supported are the pixel formats of common.h, 16-bit samples are stored in
+ * the byte order of the host.
+ */
+
+// Errors, same meaning as the LOADBMP errors
+#define TILED_NO_ERROR 0
+#define TILED_OUT_OF_MEMORY 1
+#define TILED_FILE_NOT_FOUND 2
+#define TILED_FILE_OPERATION 3
+#define TILED_INVALID_FILE_FORMAT 4
+#define TILED_INVALID_SIGNATURE 5
+
+#define TILED_DEFAULT_TILE_SIZE 256
+
+typedef struct {
+  int width;       // width of the image
+  int height;      // height of the image
+  pixel_format_t format;  // layout of a pixel
+  int tile_width;  // width of a full tile
+  int tile_height; // height of a full tile
+  int tiles_x;     // number of tiles in x direction
+  int tiles_y;     // number of tiles in y direction
+  uint64_t *tile_offsets; // offset of every tile in the file
+  uint64_t *tile_sizes;   // size of every tile in bytes
+} tiled_header_t;
+
+/**
+ * read the header and the tile index of a file.
+ * The index has to be freed with @tiled_free_header@.
+ */
+unsigned int tiled_read_header(const char *filename, tiled_header_t *header);
+
+/**
+ * free the tile index of a header.
+ */
+void tiled_free_header(tiled_header_t header);
+
+/**
+ * read the region (x,y)-(x+width-1,y+height-1) into a buffer of the given
+ * pixel format, the pixels of the file are converted if necessary.
+ *
+ * Only the tiles overlapping the region are read. The region may extend over
+ * the edges of the image, these pixels are set to zero like the border of an
+ * image.
+ */
+unsigned int tiled_read_region(const char *filename, int x, int y, int width,
+                               int height, pixel_format_t format,
+                               image_buffer_t buffer);
+
+/**
+ * read a whole file into a newly allocated buffer in the pixel format of the
+ * file.
+ */
+unsigned int tiled_decode_file(const char *filename, image_buffer_t *buffer,
+                               unsigned int *width, unsigned int *height,
+                               pixel_format_t *format);
+
+/**
+ * write a buffer of the given pixel format as a tiled file.
+ */
+unsigned int tiled_encode_file(const char *filename, image_buffer_t buffer,
+                               int width, int height, pixel_format_t format,
+                               int tile_size);
+
+/**
+ * write the distributed image as tiled file in its pixel format.
+ *
+ * Rank 0 writes header and index, afterwards every rank writes the pixels of
+ * its tile into the file tiles it overlaps. Has to be called by all ranks of
+ * the communicator.
+ */
+unsigned int tiled_write_file_parallel(const char *filename,
+                                       image_t local_img, int offset_x,
+                                       int offset_y, int img_width,
+                                       int img_height, int tile_size,
+                                       MPI_Comm comm);
+
+#endif /* SRC_TILED_H_ */
@@ -0,0 +1,89 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "loadbmp.h"
+#include "tiled.h"
+
+/*
+ * Convert images between BMP and the native tiled format. The direction is
+ * taken from the extension of the input file. BMP files are always 8-bit RGB,
+ * tiled files can be written in any pixel format.
+ */
+
+static bool has_extension(const char *filename, const char *extension) {
+  const char *dot = strrchr(filename, '.');
+  return dot != NULL && strcasecmp(dot + 1, extension) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr,
+            "SYNOPSIS: %s input output [tile_size [pixel_format]]\n"
+            "\tinput - BMP or PGT image, converted to the other format\n"
+            "\ttile_size - edge length of the tiles, default %d\n"
+            "\tpixel_format - of the PGT image, gray8, rgb8 (default), "
+            "rgbx8, gray16, rgb16 or rgbx16\n",
+            argv[0], TILED_DEFAULT_TILE_SIZE);
+    return 1;
+  }
+  int tile_size = TILED_DEFAULT_TILE_SIZE;
+  if (argc >= 4) {
+    tile_size = strtol(argv[3], NULL, 10);
+    if (tile_size <= 0) {
+      fprintf(stderr, "Invalid tile size\n");
+      return 1;
+    }
+  }
+  pixel_format_t format = PIXEL_RGB8;
+  if (argc == 5 && !parse_pixel_format(argv[4], &format)) {
+    fprintf(stderr, "Invalid pixel format\n");
+    return 1;
+  }
+
+  image_buffer_t buffer = NULL;
+  unsigned int width;
+  unsigned int height;
+  if (has_extension(argv[1], "PGT")) {
+    unsigned int err =
+        tiled_decode_file(argv[1], &buffer, &width, &height, &format);
+    if (err) {
+      printf("Tiled Load Error: %u\n", err);
+      return 1;
+    }
+    image_buffer_t rgb_buffer = (unsigned char *)malloc(width * height * 3);
+    convert_buffer(buffer, format, rgb_buffer, PIXEL_RGB8,
+                   (long)width * height);
+    free(buffer);
+    buffer = rgb_buffer;
+    err = loadbmp_encode_file(argv[2], buffer, width, height, LOADBMP_RGB);
+    if (err) {
+      printf("LoadBMP Save Error: %u\n", err);
+      free(buffer);
+      return 1;
+    }
+  } else {
+    unsigned int err =
+        loadbmp_decode_file(argv[1], &buffer, &width, &height, LOADBMP_RGB);
+    if (err) {
+      printf("LoadBMP Load Error: %u\n", err);
+      return 1;
+    }
+    image_buffer_t converted_buffer =
+        (unsigned char *)malloc((size_t)width * height * PIXEL_SIZE(format));
+    convert_buffer(buffer, PIXEL_RGB8, converted_buffer, format,
+                   (long)width * height);
+    free(buffer);
+    buffer = converted_buffer;
+    err = tiled_encode_file(argv[2], buffer, width, height, format, tile_size);
+    if (err) {
+      printf("Tiled Save Error: %u\n", err);
+      free(buffer);
+      return 1;
+    }
+  }
+  free(buffer);
+  return 0;
+}
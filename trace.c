@@ -0,0 +1,223 @@
+
+#include "trace.h"
+
+#ifdef TRACE_EVENTS
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// deepest nesting of events
+#define TRACE_MAX_DEPTH 16
+// round trips used to estimate the clock offset of a rank
+#define ALIGN_ROUNDS 16
+#define TRACE_TAG 7
+
+static const char *event_names[TRACE_EVENT_COUNT] = {
+    "iteration", "exchange", "blur", "pack", "unpack",
+    "sendrecv",  "send",     "recv", "wait", "io"};
+
+typedef struct {
+  double begin;
+  double end;
+  int event;
+  int peer;
+} trace_record_t;
+
+// begin, end, event, peer
+#define RECORD_VALUES 4
+
+static trace_record_t *ring;
+static long capacity;
+// events ever recorded, the ring holds the last capacity of them
+static long recorded;
+static int depth;
+static trace_event_t open_events[TRACE_MAX_DEPTH];
+static double open_times[TRACE_MAX_DEPTH];
+
+void trace_init(void) {
+  capacity = TRACE_DEFAULT_CAPACITY;
+  const char *events = getenv("P2_TRACE_EVENTS");
+  if (events != NULL && strtol(events, NULL, 10) > 0) {
+    capacity = strtol(events, NULL, 10);
+  }
+  ring = (trace_record_t *)malloc(sizeof(trace_record_t) * capacity);
+  recorded = 0;
+  depth = 0;
+}
+
+void trace_begin(trace_event_t event) {
+  if (depth < TRACE_MAX_DEPTH) {
+    open_events[depth] = event;
+    open_times[depth] = MPI_Wtime();
+  }
+  depth++;
+}
+
+void trace_end(trace_event_t event, int peer) {
+  double time = MPI_Wtime();
+  depth--;
+  if (ring == NULL || depth < 0 || depth >= TRACE_MAX_DEPTH) {
+    return;
+  }
+  if (open_events[depth] != event) {
+    fprintf(stderr, "trace: %s ended inside of %s\n", event_names[event],
+            event_names[open_events[depth]]);
+  }
+  trace_record_t *record = &ring[recorded % capacity];
+  record->begin = open_times[depth];
+  record->end = time;
+  record->event = event;
+  record->peer = peer;
+  recorded++;
+}
+
+/**
+ * offset of the clock of every rank to the one of rank 0, taken from the round
+ * trip with the shortest time. Only rank 0 gets the offsets.
+ */
+static void clock_offsets(MPI_Comm comm, double *offsets) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+  if (rank == 0) {
+    offsets[0] = 0.0;
+    for (int other_rank = 1; other_rank < world; other_rank++) {
+      double shortest = DBL_MAX;
+      for (int round = 0; round < ALIGN_ROUNDS; round++) {
+        double remote_time;
+        double start_time = MPI_Wtime();
+        MPI_Send(&start_time, 1, MPI_DOUBLE, other_rank, TRACE_TAG, comm);
+        MPI_Recv(&remote_time, 1, MPI_DOUBLE, other_rank, TRACE_TAG, comm,
+                 MPI_STATUS_IGNORE);
+        double end_time = MPI_Wtime();
+        if (end_time - start_time < shortest) {
+          shortest = end_time - start_time;
+          offsets[other_rank] = remote_time - (start_time + end_time) / 2.0;
+        }
+      }
+    }
+  } else {
+    for (int round = 0; round < ALIGN_ROUNDS; round++) {
+      double remote_time;
+      MPI_Recv(&remote_time, 1, MPI_DOUBLE, 0, TRACE_TAG, comm,
+               MPI_STATUS_IGNORE);
+      double time = MPI_Wtime();
+      MPI_Send(&time, 1, MPI_DOUBLE, 0, TRACE_TAG, comm);
+    }
+  }
+}
+
+static void write_trace(const char *filename, int world, const int *counts,
+                        const int *displacements, const double *values,
+                        const double *offsets, long dropped) {
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "trace: cannot write %s\n", filename);
+    return;
+  }
+  // times relative to the first event, in microseconds
+  double first = DBL_MAX;
+  for (int r = 0; r < world; r++) {
+    for (int i = 0; i < counts[r]; i += RECORD_VALUES) {
+      double begin = values[displacements[r] + i] - offsets[r];
+      if (begin < first) {
+        first = begin;
+      }
+    }
+  }
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (int r = 0; r < world; r++) {
+    fprintf(f,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+            "\"args\":{\"name\":\"rank %d\"}},\n",
+            r, r);
+  }
+  const char *separator = "";
+  for (int r = 0; r < world; r++) {
+    for (int i = 0; i < counts[r]; i += RECORD_VALUES) {
+      const double *record = &values[displacements[r] + i];
+      double begin = record[0] - offsets[r] - first;
+      double end = record[1] - offsets[r] - first;
+      fprintf(f,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+              "\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"peer\":%d}}",
+              separator, event_names[(int)record[2]], r, begin * 1e6,
+              (end - begin) * 1e6, (int)record[3]);
+      separator = ",\n";
+    }
+  }
+  fprintf(f,
+          "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"ranks\":%d,"
+          "\"dropped\":%ld}}\n",
+          world, dropped);
+  fclose(f);
+}
+
+void trace_finish(MPI_Comm comm) {
+  int rank, world;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &world);
+
+  double *offsets = (double *)malloc(sizeof(double) * world);
+  clock_offsets(comm, offsets);
+
+  // the oldest events that are still in the ring come first
+  long kept = recorded < capacity ? recorded : capacity;
+  long dropped = recorded - kept;
+  int count = (int)kept * RECORD_VALUES;
+  double *values = (double *)malloc(sizeof(double) * (count + 1));
+  for (long i = 0; i < kept; i++) {
+    const trace_record_t *record = &ring[(recorded - kept + i) % capacity];
+    values[i * RECORD_VALUES] = record->begin;
+    values[i * RECORD_VALUES + 1] = record->end;
+    values[i * RECORD_VALUES + 2] = record->event;
+    values[i * RECORD_VALUES + 3] = record->peer;
+  }
+
+  int *counts = NULL;
+  int *displacements = NULL;
+  double *all_values = NULL;
+  long all_dropped = 0;
+  if (rank == 0) {
+    counts = (int *)malloc(sizeof(int) * world);
+    displacements = (int *)malloc(sizeof(int) * world);
+  }
+  MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+  MPI_Reduce(&dropped, &all_dropped, 1, MPI_LONG, MPI_SUM, 0, comm);
+  if (rank == 0) {
+    int total = 0;
+    for (int r = 0; r < world; r++) {
+      displacements[r] = total;
+      total += counts[r];
+    }
+    all_values = (double *)malloc(sizeof(double) * (total + 1));
+  }
+  MPI_Gatherv(values, count, MPI_DOUBLE, all_values, counts, displacements,
+              MPI_DOUBLE, 0, comm);
+
+  if (rank == 0) {
+    const char *filename = getenv("P2_TRACE_FILE");
+    if (filename == NULL) {
+      filename = TRACE_DEFAULT_FILE;
+    }
+    write_trace(filename, world, counts, displacements, all_values, offsets,
+                all_dropped);
+    if (all_dropped > 0) {
+      fprintf(stderr,
+              "trace: %ld events were overwritten, increase "
+              "P2_TRACE_EVENTS\n",
+              all_dropped);
+    }
+    free(counts);
+    free(displacements);
+    free(all_values);
+  }
+  free(values);
+  free(offsets);
+  free(ring);
+  ring = NULL;
+}
+
+#endif /* TRACE_EVENTS */
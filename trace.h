@@ -0,0 +1,83 @@
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+/*
+ * Optional timeline of the events on every rank.
+ *
+ * Build with TRACE_EVENTS defined (make TRACE=1) to enable it, otherwise all
+ * macros expand to nothing. Every rank records the begin and end of its
+ * events into a ring buffer of its own, which costs two calls of MPI_Wtime and
+ * no locks or system calls. When the ring is full the oldest events are
+ * overwritten. At the end the clocks of the ranks are aligned to rank 0 and
+ * all events are written as a Chrome trace to the file named by the
+ * environment variable P2_TRACE_FILE (default TRACE_DEFAULT_FILE), which
+ * chrome://tracing and Perfetto open directly. The tool tracepath reads it
+ * and prints the critical path and the time every rank waited for each
+ * neighbour.
+ *
+ * Communication events carry the rank of the peer. The k-th receiving event
+ * of rank r from rank p (sendrecv, wait or recv) belongs to the k-th sending
+ * event of p to r (sendrecv or send).
+ */
+
+#include <mpi.h>
+
+#define TRACE_DEFAULT_FILE "p2_trace.json"
+// events kept per rank, can be changed with P2_TRACE_EVENTS
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+typedef enum {
+  TRACE_ITERATION, // one group of fused iterations including the exchange
+  TRACE_EXCHANGE,  // exchange of all borders
+  TRACE_BLUR,      // blur kernels and filter chains
+  TRACE_PACK,      // copying pixels into a send buffer
+  TRACE_UNPACK,    // copying pixels out of a receive buffer
+  TRACE_SENDRECV,  // blocking exchange with one neighbour
+  TRACE_SEND,      // sending a message, without waiting for the peer
+  TRACE_RECV,      // blocking receive
+  TRACE_WAIT,      // waiting for a nonblocking receive
+  TRACE_IO,        // loading and saving images
+  TRACE_EVENT_COUNT
+} trace_event_t;
+
+#ifdef TRACE_EVENTS
+
+/**
+ * allocate the ring buffer of this rank.
+ */
+void trace_init(void);
+
+/**
+ * start an event. Events can be nested.
+ */
+void trace_begin(trace_event_t event);
+
+/**
+ * end the innermost event, which has to be of the given type.
+ * @param peer rank in MPI_COMM_WORLD the event communicated with or -1
+ */
+void trace_end(trace_event_t event, int peer);
+
+/**
+ * align the clocks, write the events of all ranks to the trace file on rank 0
+ * and free the ring buffer. Has to be called by all ranks of the
+ * communicator.
+ */
+void trace_finish(MPI_Comm comm);
+
+#define TRACE_INIT() trace_init()
+#define TRACE_BEGIN(event) trace_begin(event)
+#define TRACE_END(event, peer) trace_end(event, peer)
+#define TRACE_FINISH(comm) trace_finish(comm)
+
+#else
+
+#define TRACE_INIT() ((void)0)
+#define TRACE_BEGIN(event) ((void)0)
+// the peer is still evaluated, it may be computed only for the trace
+#define TRACE_END(event, peer) ((void)(peer))
+#define TRACE_FINISH(comm) ((void)0)
+
+#endif /* TRACE_EVENTS */
+
+#endif /* SRC_TRACE_H_ */
@@ -0,0 +1,321 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Analyse a trace written by p2 when it was built with TRACE=1.
+ *
+ * The critical path is followed backwards from the event that ended last.
+ * Whenever a receiving event started before the matching sending event of the
+ * peer, the rank was stalled by that peer and the path continues on the peer
+ * where it started to send. Time between the traced events counts as "other".
+ * Independent of the path, the time every rank waited for each neighbour is
+ * summed up, the wait is the time from the start of a receiving event to the
+ * start of the matching sending event on the peer. When a rank overwrote
+ * events the messages cannot be matched reliably any more, then there is no
+ * critical path.
+ */
+
+// names of the events that do not contain other events
+static const char *leaf_names[] = {"blur", "pack", "unpack", "sendrecv",
+                                   "send", "recv", "wait", "io"};
+#define LEAF_COUNT ((int)(sizeof(leaf_names) / sizeof(leaf_names[0])))
+// column for the time between the traced events
+#define OTHER LEAF_COUNT
+
+typedef struct {
+  int rank;
+  int leaf;   // index in leaf_names or -1 for the outer events
+  double begin; // microseconds
+  double end;
+  int peer;   // rank of the peer or -1
+  int match;  // index of the matching sending event or -1
+} event_t;
+
+static int leaf_index(const char *name) {
+  for (int l = 0; l < LEAF_COUNT; l++) {
+    if (strcmp(name, leaf_names[l]) == 0) {
+      return l;
+    }
+  }
+  return -1;
+}
+
+static bool is_receiving(const event_t *event) {
+  return event->peer >= 0 &&
+         (event->leaf == leaf_index("sendrecv") ||
+          event->leaf == leaf_index("wait") || event->leaf == leaf_index("recv"));
+}
+
+static bool is_sending(const event_t *event) {
+  return event->peer >= 0 && (event->leaf == leaf_index("sendrecv") ||
+                              event->leaf == leaf_index("send"));
+}
+
+static int compare_events(const void *a, const void *b) {
+  const event_t *event_a = (const event_t *)a;
+  const event_t *event_b = (const event_t *)b;
+  if (event_a->rank != event_b->rank) {
+    return event_a->rank - event_b->rank;
+  }
+  if (event_a->begin != event_b->begin) {
+    return event_a->begin < event_b->begin ? -1 : 1;
+  }
+  // outer events before the ones they contain
+  return event_a->end > event_b->end ? -1 : event_a->end < event_b->end;
+}
+
+/**
+ * read the complete events of a trace.
+ * @return number of events, -1 if the file cannot be read
+ */
+static int read_trace(const char *filename, event_t **events, int *world,
+                      long *dropped) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  int count = 0;
+  int allocated = 1024;
+  *events = (event_t *)malloc(sizeof(event_t) * allocated);
+  *world = 0;
+  *dropped = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char name[32];
+    event_t event;
+    double duration;
+    const char *other = strstr(line, "\"dropped\":");
+    if (other != NULL) {
+      *dropped = strtol(other + strlen("\"dropped\":"), NULL, 10);
+    }
+    if (sscanf(line,
+               "{\"name\":\"%31[^\"]\",\"ph\":\"X\",\"pid\":%d,\"tid\":%*d,"
+               "\"ts\":%lf,\"dur\":%lf,\"args\":{\"peer\":%d}}",
+               name, &event.rank, &event.begin, &duration,
+               &event.peer) != 5) {
+      continue;
+    }
+    event.leaf = leaf_index(name);
+    event.end = event.begin + duration;
+    event.match = -1;
+    if (event.rank + 1 > *world) {
+      *world = event.rank + 1;
+    }
+    if (count == allocated) {
+      allocated *= 2;
+      *events = (event_t *)realloc(*events, sizeof(event_t) * allocated);
+    }
+    (*events)[count++] = event;
+  }
+  fclose(f);
+  qsort(*events, count, sizeof(event_t), compare_events);
+  return count;
+}
+
+/**
+ * the k-th receiving event of rank r from p belongs to the k-th sending event
+ * of p to r.
+ */
+static void match_events(event_t *events, int count, int world) {
+  int pairs = world * world;
+  int *sent = (int *)calloc(pairs, sizeof(int));
+  int *offsets = (int *)calloc(pairs + 1, sizeof(int));
+  int *received = (int *)calloc(pairs, sizeof(int));
+  for (int e = 0; e < count; e++) {
+    if (is_sending(&events[e]) && events[e].peer < world) {
+      sent[events[e].rank * world + events[e].peer]++;
+    }
+  }
+  for (int pair = 0; pair < pairs; pair++) {
+    offsets[pair + 1] = offsets[pair] + sent[pair];
+  }
+  int *sending = (int *)malloc(sizeof(int) * (offsets[pairs] + 1));
+  memset(sent, 0, sizeof(int) * pairs);
+  for (int e = 0; e < count; e++) {
+    if (is_sending(&events[e]) && events[e].peer < world) {
+      int pair = events[e].rank * world + events[e].peer;
+      sending[offsets[pair] + sent[pair]++] = e;
+    }
+  }
+  for (int e = 0; e < count; e++) {
+    if (is_receiving(&events[e]) && events[e].peer < world) {
+      int pair = events[e].peer * world + events[e].rank;
+      int k = received[pair]++;
+      if (k < sent[pair]) {
+        events[e].match = sending[offsets[pair] + k];
+      }
+    }
+  }
+  free(sent);
+  free(offsets);
+  free(received);
+  free(sending);
+}
+
+static void print_waits(const event_t *events, int count, int world) {
+  int pairs = world * world;
+  int *messages = (int *)calloc(pairs, sizeof(int));
+  double *busy = (double *)calloc(pairs, sizeof(double));
+  double *waited = (double *)calloc(pairs, sizeof(double));
+  for (int e = 0; e < count; e++) {
+    const event_t *event = &events[e];
+    if (!is_receiving(event) || event->match < 0) {
+      continue;
+    }
+    int pair = event->rank * world + event->peer;
+    double wait = events[event->match].begin - event->begin;
+    if (wait > event->end - event->begin) {
+      wait = event->end - event->begin;
+    }
+    messages[pair]++;
+    busy[pair] += event->end - event->begin;
+    waited[pair] += wait > 0.0 ? wait : 0.0;
+  }
+  printf("\nwaits per neighbour\n%6s %6s %8s %12s %12s\n", "rank", "peer",
+         "messages", "comm ms", "wait ms");
+  for (int pair = 0; pair < pairs; pair++) {
+    if (messages[pair] > 0) {
+      printf("%6d %6d %8d %12.3lf %12.3lf\n", pair / world, pair % world,
+             messages[pair], busy[pair] * 1e-3, waited[pair] * 1e-3);
+    }
+  }
+  free(messages);
+  free(busy);
+  free(waited);
+}
+
+static void print_critical_path(const event_t *events, int count, int world) {
+  // last leaf event of every rank that has not been passed yet
+  int *position = (int *)malloc(sizeof(int) * world);
+  int *first = (int *)malloc(sizeof(int) * world);
+  for (int r = 0; r < world; r++) {
+    position[r] = -1;
+    first[r] = count;
+  }
+  int rank = -1;
+  double time = 0.0;
+  for (int e = 0; e < count; e++) {
+    if (events[e].leaf < 0) {
+      continue;
+    }
+    position[events[e].rank] = e;
+    if (first[events[e].rank] == count) {
+      first[events[e].rank] = e;
+    }
+    if (rank < 0 || events[e].end > time) {
+      rank = events[e].rank;
+      time = events[e].end;
+    }
+  }
+  if (rank < 0) {
+    printf("no events\n");
+    free(position);
+    free(first);
+    return;
+  }
+
+  double end_time = time;
+  double *path = (double *)calloc(world * (LEAF_COUNT + 1), sizeof(double));
+  double *stalls = (double *)calloc(world * world, sizeof(double));
+  int *stall_counts = (int *)calloc(world * world, sizeof(int));
+  int hops = 0;
+  // time decreases on every step and only takes the begin of an event, so the
+  // walk ends after at most 2 * count steps
+  while (true) {
+    // latest leaf event of the rank that started before the current time
+    int e = position[rank];
+    while (e >= first[rank] && (events[e].leaf < 0 || events[e].begin >= time)) {
+      e--;
+    }
+    position[rank] = e;
+    if (e < first[rank]) {
+      break;
+    }
+    const event_t *event = &events[e];
+    double end = event->end < time ? event->end : time;
+    path[rank * (LEAF_COUNT + 1) + OTHER] += time - end;
+
+    // where the peer started to send, at most the end of the event
+    bool stalled = is_receiving(event) && event->match >= 0 &&
+                   events[event->match].begin > event->begin;
+    double resumed = stalled && events[event->match].begin < end
+                         ? events[event->match].begin
+                         : end;
+    if (stalled && resumed < time) {
+      // stalled by the peer, continue where it started to send
+      path[rank * (LEAF_COUNT + 1) + event->leaf] += end - resumed;
+      stalls[rank * world + event->peer] += resumed - event->begin;
+      stall_counts[rank * world + event->peer]++;
+      rank = event->peer;
+      time = resumed;
+      hops++;
+    } else {
+      path[rank * (LEAF_COUNT + 1) + event->leaf] += end - event->begin;
+      time = event->begin;
+    }
+  }
+
+  printf("critical path %.3lf ms, %d hops between ranks\n%6s",
+         (end_time - time) * 1e-3, hops, "rank");
+  for (int l = 0; l < LEAF_COUNT; l++) {
+    printf(" %9s", leaf_names[l]);
+  }
+  printf(" %9s %9s\n", "other", "total");
+  for (int r = 0; r < world; r++) {
+    double total = 0.0;
+    printf("%6d", r);
+    for (int l = 0; l <= LEAF_COUNT; l++) {
+      printf(" %9.3lf", path[r * (LEAF_COUNT + 1) + l] * 1e-3);
+      total += path[r * (LEAF_COUNT + 1) + l];
+    }
+    printf(" %9.3lf\n", total * 1e-3);
+  }
+
+  printf("\nstalls on the critical path\n%6s %6s %8s %12s\n", "rank",
+         "by", "count", "ms");
+  for (int pair = 0; pair < world * world; pair++) {
+    if (stall_counts[pair] > 0) {
+      printf("%6d %6d %8d %12.3lf\n", pair / world, pair % world,
+             stall_counts[pair], stalls[pair] * 1e-3);
+    }
+  }
+
+  free(position);
+  free(first);
+  free(path);
+  free(stalls);
+  free(stall_counts);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr,
+            "SYNOPSIS: %s trace\n"
+            "\ttrace - JSON file written by p2 built with TRACE=1\n",
+            argv[0]);
+    return 1;
+  }
+  event_t *events;
+  int world;
+  long dropped;
+  int count = read_trace(argv[1], &events, &world, &dropped);
+  if (count < 0) {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+  match_events(events, count, world);
+  if (dropped > 0) {
+    // the k-th receive no longer belongs to the k-th send
+    fprintf(stderr,
+            "%ld events were overwritten, no critical path and the waits "
+            "are unreliable. Increase P2_TRACE_EVENTS.\n",
+            dropped);
+  } else {
+    print_critical_path(events, count, world);
+  }
+  print_waits(events, count, world);
+  free(events);
+  return 0;
+}